@@ -0,0 +1,101 @@
+#if !defined(__ARDUINO_H_)
+#define __ARDUINO_H_
+
+// Just enough of the Arduino core for the engine sources in modal_keys/ to build on Linux.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+// flash and RAM are the same address space here
+#define PROGMEM
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define pgm_read_word(address) (*(const uint16_t *)(address))
+#define pgm_read_ptr(address) (*(void * const *)(address))
+
+// F() strings are plain ones, with the core's type so that the same overloads take them
+class __FlashStringHelper;
+#define F(str) (reinterpret_cast<const __FlashStringHelper *>(str))
+
+// ****************************************************************************
+// String
+// ****************************************************************************
+
+class String {
+public:
+    String() {}
+    String(const char *str) : text(str) {}
+    String(const std::string &str) : text(str) {}
+    String(char c) : text(1, c) {}
+    String(int value) : text(std::to_string(value)) {}
+    String(unsigned int value) : text(std::to_string(value)) {}
+    String(long value) : text(std::to_string(value)) {}
+    String(unsigned long value) : text(std::to_string(value)) {}
+
+    unsigned int length() const { return text.size(); }
+    const char *c_str() const { return text.c_str(); }
+    String substring(unsigned int from) const { return from < text.size() ? text.substr(from) : ""; }
+    String substring(unsigned int from, unsigned int to) const {
+        return from < text.size() && from < to ? text.substr(from, to - from) : "";
+    }
+
+    String &operator+=(const String &other) { text += other.text; return *this; }
+    String &operator+=(const char *other) { text += other; return *this; }
+    String &operator+=(char c) { text += c; return *this; }
+    bool operator==(const String &other) const { return text == other.text; }
+    char operator[](unsigned int index) const { return text[index]; }
+
+    friend String operator+(const String &a, const String &b) { return a.text + b.text; }
+    friend String operator+(const String &a, const char *b) { return a.text + b; }
+    friend String operator+(const char *a, const String &b) { return a + b.text; }
+
+private:
+    std::string text;
+};
+
+// ****************************************************************************
+// Serial
+// ****************************************************************************
+
+// Text (the log) goes to stderr. Binary data (command frames) is read from and written to
+// the control file descriptor, if the daemon has one.
+class HardwareSerial {
+public:
+    int controlFd = -1;
+    bool logToStderr = false;
+
+    void begin(unsigned long baud) {}
+    int available();
+    int read();
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buf, size_t length);
+    void print(const String &str);
+    void print(const char *str);
+    void println(const String &str);
+    void println(const char *str);
+    void println();
+
+private:
+    uint8_t readBuffer[64];
+    uint8_t readLength = 0;
+    uint8_t readIndex = 0;
+};
+
+extern HardwareSerial Serial;
+
+// ****************************************************************************
+// Time
+// ****************************************************************************
+
+extern uint32_t millis();
+extern uint32_t micros();
+extern void delay(unsigned long ms);
+extern void delayMicroseconds(unsigned int us);
+
+#endif // __ARDUINO_H_
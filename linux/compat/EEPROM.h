@@ -0,0 +1,42 @@
+#if !defined(__EEPROM_H_)
+#define __EEPROM_H_
+
+#include <Arduino.h>
+
+#define EEPROMSize 1024
+
+// The ATmega32U4's 1KB EEPROM, kept in RAM and written through to a file if one is open.
+class EEPROMClass {
+public:
+    EEPROMClass() { memset(data, 0xFF, sizeof(data)); }     // erased
+
+    bool open(const char *path);
+    uint8_t read(int address);
+    void write(int address, uint8_t value);
+    void update(int address, uint8_t value) { if (read(address) != value) write(address, value); }
+    uint16_t length() { return EEPROMSize; }
+
+    template<typename T> T &get(int address, T &value) {
+        uint8_t *bytes = (uint8_t *)&value;
+        for (size_t i = 0; i < sizeof(T); i++) bytes[i] = read(address + i);
+        return value;
+    }
+    template<typename T> const T &put(int address, const T &value) {
+        const uint8_t *bytes = (const uint8_t *)&value;
+        for (size_t i = 0; i < sizeof(T); i++) update(address + i, bytes[i]);
+        return value;
+    }
+
+private:
+    uint8_t data[EEPROMSize];
+    int fd = -1;
+};
+
+extern EEPROMClass EEPROM;
+
+// writes complete immediately
+inline bool eeprom_is_ready() {
+    return true;
+}
+
+#endif // __EEPROM_H_
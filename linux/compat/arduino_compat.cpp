@@ -0,0 +1,121 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+
+// ****************************************************************************
+// Serial
+// ****************************************************************************
+
+int HardwareSerial::available() {
+    if (readIndex == readLength && controlFd >= 0) {
+        ssize_t length = ::read(controlFd, readBuffer, sizeof(readBuffer));
+        readLength = length > 0 ? length : 0;
+        readIndex = 0;
+    }
+    return readLength - readIndex;
+}
+
+int HardwareSerial::read() {
+    if (!available()) return -1;
+    return readBuffer[readIndex++];
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t length) {
+    if (controlFd < 0) return length;
+    size_t written = 0;
+    while (written < length) {
+        ssize_t n = ::write(controlFd, buf + written, length - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;     // nobody listening: drop the rest, as a closed serial port would
+        written += n;
+    }
+    return written;
+}
+
+void HardwareSerial::print(const String &str) {
+    print(str.c_str());
+}
+
+void HardwareSerial::print(const char *str) {
+    if (logToStderr) fputs(str, stderr);
+}
+
+void HardwareSerial::println(const String &str) {
+    println(str.c_str());
+}
+
+void HardwareSerial::println(const char *str) {
+    if (logToStderr) fprintf(stderr, "%s\n", str);
+}
+
+void HardwareSerial::println() {
+    println("");
+}
+
+// ****************************************************************************
+// EEPROM
+// ****************************************************************************
+
+// Load the contents of `path`, creating it if needed. Later writes go straight to the file.
+bool EEPROMClass::open(const char *path) {
+    fd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return false;
+    ssize_t length = pread(fd, data, sizeof(data), 0);
+    if (length < 0) length = 0;
+    if (length < EEPROMSize) {
+        memset(data + length, 0xFF, EEPROMSize - length);
+        pwrite(fd, data, sizeof(data), 0);
+    }
+    return true;
+}
+
+uint8_t EEPROMClass::read(int address) {
+    return (address >= 0 && address < EEPROMSize) ? data[address] : 0xFF;
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+    if (address < 0 || address >= EEPROMSize) return;
+    data[address] = value;
+    if (fd >= 0) pwrite(fd, &value, 1, address);
+}
+
+// ****************************************************************************
+// Time
+// ****************************************************************************
+
+static uint64_t MonotonicMicros() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static const uint64_t StartMicros = MonotonicMicros();
+
+// like on the Arduino, these count from startup and wrap around
+uint32_t millis() {
+    return (uint32_t)((MonotonicMicros() - StartMicros) / 1000);
+}
+
+uint32_t micros() {
+    return (uint32_t)(MonotonicMicros() - StartMicros);
+}
+
+void delay(unsigned long ms) {
+    usleep(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+    usleep(us);
+}
@@ -0,0 +1,120 @@
+#include "evdev_keys.h"
+#include "helpers.h"
+
+#include <linux/input-event-codes.h>
+
+// ****************************************************************************
+// Constants
+// ****************************************************************************
+
+// Linux key code for each HID usage, as in the kernel's hid-input.c
+const uint16_t HidUsageKeys[MaxHidUsage + 1] = {
+    0, 0, 0, 0,
+    KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G, KEY_H, KEY_I, KEY_J, KEY_K, KEY_L,
+    KEY_M, KEY_N, KEY_O, KEY_P, KEY_Q, KEY_R, KEY_S, KEY_T, KEY_U, KEY_V, KEY_W, KEY_X,
+    KEY_Y, KEY_Z, KEY_1, KEY_2, KEY_3, KEY_4, KEY_5, KEY_6, KEY_7, KEY_8, KEY_9, KEY_0,
+    KEY_ENTER, KEY_ESC, KEY_BACKSPACE, KEY_TAB, KEY_SPACE, KEY_MINUS, KEY_EQUAL, KEY_LEFTBRACE,
+    KEY_RIGHTBRACE, KEY_BACKSLASH, 0 /* non-US #, same code as backslash */, KEY_SEMICOLON,
+    KEY_APOSTROPHE, KEY_GRAVE, KEY_COMMA, KEY_DOT, KEY_SLASH, KEY_CAPSLOCK,
+    KEY_F1, KEY_F2, KEY_F3, KEY_F4, KEY_F5, KEY_F6, KEY_F7, KEY_F8, KEY_F9, KEY_F10, KEY_F11, KEY_F12,
+    KEY_SYSRQ, KEY_SCROLLLOCK, KEY_PAUSE, KEY_INSERT, KEY_HOME, KEY_PAGEUP, KEY_DELETE, KEY_END,
+    KEY_PAGEDOWN, KEY_RIGHT, KEY_LEFT, KEY_DOWN, KEY_UP, KEY_NUMLOCK,
+    KEY_KPSLASH, KEY_KPASTERISK, KEY_KPMINUS, KEY_KPPLUS, KEY_KPENTER, KEY_KP1, KEY_KP2, KEY_KP3,
+    KEY_KP4, KEY_KP5, KEY_KP6, KEY_KP7, KEY_KP8, KEY_KP9, KEY_KP0, KEY_KPDOT,
+    KEY_102ND, KEY_COMPOSE, KEY_POWER, KEY_KPEQUAL,
+    KEY_F13, KEY_F14, KEY_F15, KEY_F16, KEY_F17, KEY_F18, KEY_F19, KEY_F20,
+    KEY_F21, KEY_F22, KEY_F23, KEY_F24
+};
+
+// Linux key code for each modifier bit, LCtrl first
+const uint16_t ModifierKeys[8] = {
+    KEY_LEFTCTRL, KEY_LEFTSHIFT, KEY_LEFTALT, KEY_LEFTMETA,
+    KEY_RIGHTCTRL, KEY_RIGHTSHIFT, KEY_RIGHTALT, KEY_RIGHTMETA
+};
+
+// Linux LED code for each LED bit
+const uint16_t LedCodes[NumHidLeds] = {
+    LED_NUML, LED_CAPSL, LED_SCROLLL
+};
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+uint16_t HidUsageToEvdev(uint8_t usage) {
+    return usage <= MaxHidUsage ? HidUsageKeys[usage] : 0;
+}
+
+uint16_t ModifierToEvdev(uint8_t modifierBit) {
+    for (uint8_t bit = 0; bit < 8; bit++) {
+        if (modifierBit == (1 << bit)) return ModifierKeys[bit];
+    }
+    return 0;
+}
+
+// Sets either *usage or *modifierBit, or neither for keys a boot keyboard doesn't have.
+void EvdevToHid(uint16_t code, uint8_t *usage, uint8_t *modifierBit) {
+    *usage = 0;
+    *modifierBit = 0;
+    if (code == 0) return;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+        if (ModifierKeys[bit] == code) {
+            *modifierBit = 1 << bit;
+            return;
+        }
+    }
+    for (uint8_t i = 0; i <= MaxHidUsage; i++) {
+        if (HidUsageKeys[i] == code) {
+            *usage = i;
+            return;
+        }
+    }
+}
+
+bool ApplyKeyEvent(uint8_t report[8], uint16_t code, int32_t value) {
+    uint8_t usage, modifierBit;
+    EvdevToHid(code, &usage, &modifierBit);
+
+    if (modifierBit) {
+        uint8_t mods = value ? (report[0] | modifierBit) : (report[0] & ~modifierBit);
+        if (mods == report[0]) return false;
+        report[0] = mods;
+        return true;
+    }
+    if (!usage) return false;
+
+    if (value) {
+        if (IsKeyPressedInBuffer(usage, report)) return false;
+        for (uint8_t i = 2; i < 8; i++) {
+            if (report[i] == 0) {
+                report[i] = usage;
+                return true;
+            }
+        }
+        return false;   // a boot report only has room for six keys
+    }
+
+    for (uint8_t i = 2; i < 8; i++) {
+        if (report[i] == usage) {
+            for (uint8_t j = i; j < 7; j++) report[j] = report[j + 1];
+            report[7] = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint16_t LedToEvdev(uint8_t ledBit) {
+    for (uint8_t bit = 0; bit < NumHidLeds; bit++) {
+        if (ledBit == (1 << bit)) return LedCodes[bit];
+    }
+    return 0;
+}
+
+// 0 for LEDs a boot keyboard doesn't have
+uint8_t EvdevToLed(uint16_t code) {
+    for (uint8_t bit = 0; bit < NumHidLeds; bit++) {
+        if (LedCodes[bit] == code) return 1 << bit;
+    }
+    return 0;
+}
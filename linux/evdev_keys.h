@@ -0,0 +1,26 @@
+#if !defined(__EVDEV_KEYS_H_)
+#define __EVDEV_KEYS_H_
+
+#include <Arduino.h>
+
+// Translation between Linux input event codes (KEY_*) and the USB HID usages of the
+// 8-byte boot keyboard reports the engine works on.
+
+// largest HID usage with a Linux key code (F24)
+#define MaxHidUsage 0x73
+
+extern uint16_t HidUsageToEvdev(uint8_t usage);
+extern uint16_t ModifierToEvdev(uint8_t modifierBit);
+extern void EvdevToHid(uint16_t code, uint8_t *usage, uint8_t *modifierBit);
+
+// the boot keyboard's LEDs: Num Lock, Caps Lock, Scroll Lock, as bits of its output report
+#define NumHidLeds 3
+
+extern uint16_t LedToEvdev(uint8_t ledBit);
+extern uint8_t EvdevToLed(uint16_t code);
+
+// Apply a key event (value 1 = press, 0 = release) to a report, keeping keys in the
+// order they were pressed like a boot keyboard does. Returns true if the report changed.
+extern bool ApplyKeyEvent(uint8_t report[8], uint16_t code, int32_t value);
+
+#endif // __EVDEV_KEYS_H_
@@ -0,0 +1,418 @@
+// Runs the modal keys engine on Linux: reads a keyboard's evdev events, turns them into the same
+// 8-byte reports the USB Host Shield delivers, and writes the engine's output to a uinput device.
+//
+// Input and output can also be files or pipes of struct input_event records, for testing.
+
+#include "modal_keys.h"
+#include "keymap.h"
+#include "keymap_vm.h"
+#include "helpers.h"
+#include "combos.h"
+#include "commands.h"
+#include "home_row.h"
+#include "leader.h"
+#include "leds.h"
+#include "macros.h"
+#include "oneshot.h"
+#include "report_queue.h"
+#include "scheduler.h"
+#include "typing.h"
+#include "usb_watchdog.h"
+#include "tuning.h"
+#include "usage.h"
+#include "evdev_keys.h"
+#include "uinput_output.h"
+
+#include <EEPROM.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#include <linux/input.h>
+
+// epoll timeout while something is waiting on a timer (report pacing, combo window, one-shot
+// modifier and leader timeouts, EEPROM flush) or the log
+#define BusyTimeoutMillis 1
+#define IdleTimeoutMillis 100
+
+// how long to wait for keys held at startup (e.g. Enter from starting the daemon) to be released
+#define GrabWaitMillis 3000
+
+// how often to try opening a keyboard that went away again
+#define ReopenIntervalMillis 50
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+const char *InputPath = NULL;
+bool GrabInput = true;
+int InputFd = -1;
+bool InputIsDevice = false;
+bool InputIsPollable = true;
+// the end of a pipe counts as the keyboard going away, as a device that fails does (for tests)
+bool ReopenPipe = false;
+bool InputFinished = false;
+// the keyboard device went away (unplugged, a KVM switch); it is opened again when it is back
+bool InputLost = false;
+// GetUsbHostState has reported it, so the watchdog has released the keys
+bool InputLossSeen = false;
+uint32_t ReopenTriedMillis = 0;
+// events are being discarded after the kernel dropped some, until the next SYN_REPORT
+bool InputDropped = false;
+
+int EpollFd = -1;
+int ControlFd = -1;
+int ControlSlaveFd = -1;
+
+volatile sig_atomic_t Running = 1;
+
+// the report built from the key events so far, and the last one handed to the engine
+uint8_t KeyboardReport[8] = { 0 };
+uint8_t PreviousReport[8] = { 0 };
+
+// time from reading a report's SYN_REPORT until the engine is done with it
+uint32_t ReportsProcessed = 0;
+uint64_t TotalProcessMicros = 0;
+uint32_t MaxProcessMicros = 0;
+
+// ****************************************************************************
+// Helper Functions
+// ****************************************************************************
+
+void HandleSignal(int signal) {
+    Running = 0;
+}
+
+// Rebuild the report from the device's key state, after the kernel dropped events.
+void ResyncKeyboardReport() {
+    uint8_t keys[KEY_MAX / 8 + 1] = { 0 };
+    if (!InputIsDevice || ioctl(InputFd, EVIOCGKEY(sizeof(keys)), keys) < 0) return;
+    uint8_t report[8] = { 0 };
+    // keep the keys that are still down in their original order, then add any others
+    for (uint8_t i = 2; i < 8; i++) {
+        uint16_t code = HidUsageToEvdev(KeyboardReport[i]);
+        if (code && (keys[code / 8] & (1 << (code % 8)))) ApplyKeyEvent(report, code, 1);
+    }
+    for (uint16_t code = 1; code <= KEY_MAX; code++) {
+        if (keys[code / 8] & (1 << (code % 8))) ApplyKeyEvent(report, code, 1);
+    }
+    CopyBuf(report, KeyboardReport);
+}
+
+void SendReportToEngine() {
+    if (EqualBuffers(KeyboardReport, PreviousReport)) return;
+    uint32_t start = micros();
+    uint8_t report[8];
+    CopyBuf(KeyboardReport, report);
+    ParseReport(report, PreviousReport);
+    DrainReportQueue();
+
+    uint32_t elapsed = micros() - start;
+    ReportsProcessed++;
+    TotalProcessMicros += elapsed;
+    if (elapsed > MaxProcessMicros) MaxProcessMicros = elapsed;
+}
+
+// A device that fails is waited for to come back; the end of a file or pipe ends the daemon,
+// unless the pipe is to be opened again.
+void EndInput() {
+    if (InputIsPollable) epoll_ctl(EpollFd, EPOLL_CTL_DEL, InputFd, NULL);
+    if (!InputIsDevice && !(ReopenPipe && InputIsPollable)) {
+        InputFinished = true;
+        return;
+    }
+    close(InputFd);
+    InputFd = -1;
+    InputLost = true;
+    InputLossSeen = false;
+    ReopenTriedMillis = millis();
+    memset(KeyboardReport, 0, sizeof(KeyboardReport));
+    memset(PreviousReport, 0, sizeof(PreviousReport));
+    InputDropped = false;
+}
+
+void ReadInputEvents() {
+    struct input_event events[64];
+    ssize_t length = read(InputFd, events, sizeof(events));
+    if (length == 0 || (length < 0 && errno != EAGAIN && errno != EINTR)) {
+        if (length < 0) perror("input");
+        EndInput();
+        return;
+    }
+    for (ssize_t n = 0; n < length / (ssize_t)sizeof(struct input_event); n++) {
+        const struct input_event &event = events[n];
+        if (event.type == EV_SYN && event.code == SYN_DROPPED) {
+            InputDropped = true;
+        } else if (event.type == EV_SYN && event.code == SYN_REPORT) {
+            if (InputDropped) ResyncKeyboardReport();
+            InputDropped = false;
+            SendReportToEngine();
+        } else if (event.type == EV_KEY && event.value != 2 && !InputDropped) {
+            // the host does key repeat (value 2), the engine only sees presses and releases
+            ApplyKeyEvent(KeyboardReport, event.code, event.value);
+        }
+    }
+}
+
+bool AnyKeyDown(int fd) {
+    uint8_t keys[KEY_MAX / 8 + 1] = { 0 };
+    if (ioctl(fd, EVIOCGKEY(sizeof(keys)), keys) < 0) return false;
+    for (size_t i = 0; i < sizeof(keys); i++) {
+        if (keys[i]) return true;
+    }
+    return false;
+}
+
+bool OpenInput(const char *path, bool grab, bool waitForRelease) {
+    struct stat info;
+    if (stat(path, &info) < 0) {
+        perror(path);
+        return false;
+    }
+    InputIsDevice = S_ISCHR(info.st_mode);
+    // a device is also written to, for its LEDs; a pipe opened for writing would never end
+    InputFd = open(path, (InputIsDevice ? O_RDWR : O_RDONLY) | O_NONBLOCK);
+    if (InputFd < 0) {
+        perror(path);
+        return false;
+    }
+    // epoll doesn't take regular files; they are always readable anyway
+    InputIsPollable = !S_ISREG(info.st_mode);
+
+    if (InputIsDevice && grab) {
+        for (uint32_t start = millis(); waitForRelease && AnyKeyDown(InputFd) && millis() - start < GrabWaitMillis; ) {
+            delay(10);
+        }
+        if (ioctl(InputFd, EVIOCGRAB, 1) < 0) {
+            perror("grab");
+            close(InputFd);
+            return false;
+        }
+    }
+    if (InputIsPollable) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = InputFd;
+        epoll_ctl(EpollFd, EPOLL_CTL_ADD, InputFd, &event);
+    }
+    return true;
+}
+
+// The serial command interface, on a file/FIFO or on a new pseudo terminal that
+// tools/modal_keys_cli.py can open like the Arduino's serial port.
+bool OpenControl(const char *path) {
+    if (strcmp(path, "pty") != 0) {
+        ControlFd = open(path, O_RDWR | O_NONBLOCK);
+        if (ControlFd < 0) perror(path);
+        return ControlFd >= 0;
+    }
+
+    ControlFd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (ControlFd < 0 || grantpt(ControlFd) < 0 || unlockpt(ControlFd) < 0) {
+        perror("pty");
+        return false;
+    }
+    // keeping the other end open avoids hangups while no client is connected
+    ControlSlaveFd = open(ptsname(ControlFd), O_RDWR | O_NOCTTY);
+    struct termios settings;
+    if (ControlSlaveFd < 0 || tcgetattr(ControlSlaveFd, &settings) < 0) {
+        perror("pty");
+        return false;
+    }
+    cfmakeraw(&settings);
+    tcsetattr(ControlSlaveFd, TCSANOW, &settings);
+    fprintf(stderr, "serial commands on %s\n", ptsname(ControlFd));
+    return true;
+}
+
+// The host's LED events on the virtual keyboard, merged into the keyboard's LEDs by LedTask.
+void ReadHostLedEvents() {
+    uint8_t leds;
+    if (ReadHostLeds(leds)) SetHostLeds(leds);
+}
+
+// The platform side of the USB watchdog (see usb_watchdog.h): an evdev device is either there or
+// not, and one that went away is opened again as soon as it is back.
+UsbHostState GetUsbHostState() {
+    if (!InputLost) return UsbHostRunning;
+    if (!InputLossSeen || millis() - ReopenTriedMillis < ReopenIntervalMillis) {
+        InputLossSeen = true;
+        return UsbHostNoDevice;
+    }
+    ReopenTriedMillis = millis();
+    if (access(InputPath, F_OK) < 0) return UsbHostNoDevice;
+    // the device node can show up before it can be opened
+    if (!OpenInput(InputPath, GrabInput, false)) return UsbHostEnumerating;
+    InputLost = false;
+    return UsbHostRunning;
+}
+
+// uinput takes events as soon as the virtual keyboard has been created
+bool HostReady() {
+    return true;
+}
+
+void RestartUsbHost(bool resetController) {
+    // the kernel enumerates the keyboard; opening it again is all there is to do here
+}
+
+int NextTimeout() {
+    if (!InputIsPollable && !InputFinished) return 0;
+    if (ReportQueueDepth() || CombosPending() || OneShotsPending() || LeaderActive() || MacroPlaying() ||
+        TypingPending() || HomeRowPending() || IsFlushingUsage() || IsSavingCustomKeymap() || IsWritingKeymapPrograms() || IsSavingMacro() || LogPending() || Serial.available())
+        return BusyTimeoutMillis;
+    if (InputLost) return ReopenIntervalMillis;
+    return IdleTimeoutMillis;
+}
+
+// The scheduler's UsbPollTask. Devices and pipes are read when epoll says so; regular files
+// (which epoll doesn't take) are read here.
+void PollUsb() {
+    if (!InputIsPollable && !InputFinished) ReadInputEvents();
+}
+
+// LED events to the keyboard, as the kernel does for its own LED state
+KeyboardLedsProgress SetKeyboardLeds(uint8_t leds) {
+    if (!InputIsDevice) return KeyboardLedsSent;
+    if (InputLost) return KeyboardLedsFailed;
+    struct input_event events[NumHidLeds + 1];
+    memset(events, 0, sizeof(events));
+    for (uint8_t bit = 0; bit < NumHidLeds; bit++) {
+        events[bit].type = EV_LED;
+        events[bit].code = LedToEvdev(1 << bit);
+        events[bit].value = (leds >> bit) & 1;
+    }
+    events[NumHidLeds].type = EV_SYN;
+    events[NumHidLeds].code = SYN_REPORT;
+    return write(InputFd, events, sizeof(events)) == sizeof(events) ? KeyboardLedsSent : KeyboardLedsFailed;
+}
+
+void PrintUsage(const char *name) {
+    fprintf(stderr,
+        "usage: %s --input PATH [options]\n"
+        "  -i, --input PATH     evdev keyboard (/dev/input/by-id/...-event-kbd), or a file or pipe\n"
+        "                       of struct input_event records\n"
+        "  -o, --output PATH    " UinputPath " (default) creates a virtual keyboard, any other path\n"
+        "                       receives struct input_event records\n"
+        "  -e, --eeprom PATH    file holding the configuration the Arduino keeps in EEPROM\n"
+        "  -c, --control PATH   serial command interface on a file or FIFO, or 'pty' for a new\n"
+        "                       pseudo terminal\n"
+        "  -l, --log            write the engine's log to stderr\n"
+        "  -n, --no-grab        don't take exclusive access of the keyboard\n"
+        "  -r, --reopen         treat the end of a pipe as the keyboard going away, and open it\n"
+        "                       again (for testing); the daemon then runs until it is stopped\n", name);
+}
+
+// ****************************************************************************
+// Main
+// ****************************************************************************
+
+int main(int argc, char *argv[]) {
+    const char *inputPath = NULL;
+    const char *outputPath = UinputPath;
+    const char *eepromPath = NULL;
+    const char *controlPath = NULL;
+    bool grab = true;
+    WriteToLog = false;
+
+    static const struct option options[] = {
+        { "input", required_argument, NULL, 'i' },
+        { "output", required_argument, NULL, 'o' },
+        { "eeprom", required_argument, NULL, 'e' },
+        { "control", required_argument, NULL, 'c' },
+        { "log", no_argument, NULL, 'l' },
+        { "no-grab", no_argument, NULL, 'n' },
+        { "reopen", no_argument, NULL, 'r' },
+        { NULL, 0, NULL, 0 }
+    };
+    for (int option; (option = getopt_long(argc, argv, "i:o:e:c:lnr", options, NULL)) != -1; ) {
+        switch (option) {
+            case 'i': inputPath = optarg; break;
+            case 'o': outputPath = optarg; break;
+            case 'e': eepromPath = optarg; break;
+            case 'c': controlPath = optarg; break;
+            case 'l': WriteToLog = true; break;
+            case 'n': grab = false; break;
+            case 'r': ReopenPipe = true; break;
+            default:
+                PrintUsage(argv[0]);
+                return 2;
+        }
+    }
+    if (!inputPath) {
+        PrintUsage(argv[0]);
+        return 2;
+    }
+
+    if (eepromPath && !EEPROM.open(eepromPath)) {
+        perror(eepromPath);
+        return 1;
+    }
+    InputPath = inputPath;
+    GrabInput = grab;
+    EpollFd = epoll_create1(0);
+    if (!OpenInput(inputPath, grab, true) || !OpenOutput(outputPath)) return 1;
+    if (controlPath && !OpenControl(controlPath)) return 1;
+
+    Serial.controlFd = ControlFd;
+    Serial.logToStderr = WriteToLog;
+    InitializeState();
+    InitializeCommands();
+
+    signal(SIGINT, HandleSignal);
+    signal(SIGTERM, HandleSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    if (ControlFd >= 0) {
+        event.data.fd = ControlFd;
+        epoll_ctl(EpollFd, EPOLL_CTL_ADD, ControlFd, &event);
+    }
+    if (HostLedFd() >= 0) {
+        event.data.fd = HostLedFd();
+        epoll_ctl(EpollFd, EPOLL_CTL_ADD, HostLedFd(), &event);
+    }
+
+    // after the input ends, keep going until everything it caused has been sent
+    while (Running && !(InputFinished && !ReportQueueDepth() && !CombosPending() && !HomeRowPending())) {
+        struct epoll_event ready[3];
+        int count = epoll_wait(EpollFd, ready, 3, NextTimeout());
+        if (count < 0 && errno != EINTR) {
+            perror("epoll");
+            break;
+        }
+        for (int n = 0; n < count; n++) {
+            if (ready[n].data.fd == HostLedFd()) ReadHostLedEvents();
+            if (InputFd < 0 || ready[n].data.fd != InputFd) continue;
+            if (ready[n].events & EPOLLIN) ReadInputEvents();
+            else EndInput();        // EPOLLHUP/EPOLLERR without data: writer gone or device unplugged
+        }
+        // loop() passes continuously on the Arduino. One pass per wakeup would leave an overdue task
+        // waiting for all the others, a timeout each (the watchdog over a second when idle).
+        for (uint8_t n = NumKeyPathTasks; n < NumTasks; n++) RunTasks();
+    }
+
+    CloseOutput();
+    while (LogPending()) DrainLog();
+    // the Arduino loses the counts since the last flush when unplugged; a daemon can do better
+    if (Tunings[UsageFlushMinutesTuning]) FlushUsage();
+    while (IsFlushingUsage()) UsageTask();
+    while (IsSavingCustomKeymap()) CustomKeymapTask();
+    while (IsWritingKeymapPrograms()) KeymapProgramTask();
+    while (IsSavingMacro()) MacroTask();
+    if (ReportsProcessed) {
+        fprintf(stderr, "%u reports, processed in %.1f us mean / %u us max\n",
+            ReportsProcessed, (double)TotalProcessMicros / ReportsProcessed, MaxProcessMicros);
+    }
+    return 0;
+}
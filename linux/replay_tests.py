@@ -0,0 +1,280 @@
+#!/usr/bin/env python3
+"""Replay recorded key events through modal_keys_daemon and check what it types.
+
+Each case is a list of input reports, the evdev key events between two SYN_REPORTs, and the
+output reports expected from the daemon's uinput keyboard in the same form. Keys are evdev
+names without KEY_, "+" for a press and "-" for a release. A number between the reports is a
+pause in ms, for the timeouts, and "reconnect" unplugs the keyboard and plugs it in again: those
+cases feed the daemon through a FIFO in real time, the others from a file. The daemon starts from an erased EEPROM: Windows, dvorak, ModalNoKeysMode,
+with the default tunings (see modal_keys/tuning.h) other than those a case sets.
+
+    make -C linux check
+"""
+
+import os
+import signal
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+# struct input_event on 64-bit Linux
+EVENT = struct.Struct("llHHi")
+EV_SYN = 0
+EV_KEY = 1
+
+# evdev codes, as in linux/input-event-codes.h
+KEYS = {
+    "ESC": 1, "MINUS": 12, "EQUAL": 13, "BACKSPACE": 14, "TAB": 15, "LEFTBRACE": 26, "RIGHTBRACE": 27,
+    "ENTER": 28, "LEFTCTRL": 29, "SEMICOLON": 39, "APOSTROPHE": 40, "GRAVE": 41, "LEFTSHIFT": 42,
+    "BACKSLASH": 43, "COMMA": 51, "DOT": 52, "SLASH": 53, "RIGHTSHIFT": 54, "LEFTALT": 56, "SPACE": 57,
+    "CAPSLOCK": 58, "RIGHTCTRL": 97, "RIGHTALT": 100, "HOME": 102, "UP": 103, "PAGEUP": 104, "LEFT": 105,
+    "RIGHT": 106, "END": 107, "DOWN": 108, "PAGEDOWN": 109, "INSERT": 110, "DELETE": 111,
+    "LEFTMETA": 125, "RIGHTMETA": 126, "KP0": 82, "KPPLUS": 78,
+}
+KEYS.update({str((digit + 1) % 10): 2 + digit for digit in range(10)})
+KEYS.update({key: 16 + i for i, key in enumerate("QWERTYUIOP")})
+KEYS.update({key: 30 + i for i, key in enumerate("ASDFGHJKL")})
+KEYS.update({key: 44 + i for i, key in enumerate("ZXCVBNM")})
+KEYS.update({"F%d" % (n + 1): 59 + n for n in range(10)})
+KEYS.update({"KP%d" % n: code for n, code in zip(range(1, 10), [79, 80, 81, 75, 76, 77, 71, 72, 73])})
+NAMES = {code: name for name, code in KEYS.items()}
+
+TUNINGS_SLOT = 4    # modal_keys/eeprom_layout.h
+EEPROM_SIZE = 1024
+
+# longer than the daemon takes to notice the end of its input and open it again
+RECONNECT_SECONDS = 0.2
+
+CASES = [
+    # The top layer's exit condition applies to keys whose layer is remembered: releasing Alt and
+    # C while H stays held leaves WindowSnap, as it does when H wasn't pressed in it before.
+    ("window snap exits with a remembered key held",
+     [["+LEFTALT"], ["+C"], ["+H"], ["-LEFTALT", "-C"], ["-H"]],
+     [["+LEFTCTRL", "+LEFTMETA"], ["+D"], ["-LEFTCTRL", "-LEFTMETA", "-D"], ["+BACKSPACE"], ["-BACKSPACE"]]),
+    ("window snap exits on a new key",
+     [["+LEFTALT"], ["+C"], ["-LEFTALT", "-C", "+H"], ["-H"]],
+     [["+LEFTCTRL", "+LEFTMETA"], ["-LEFTCTRL", "-LEFTMETA"], ["+BACKSPACE"], ["-BACKSPACE"]]),
+
+    # Combos (modal_keys/combos.cpp): J and K pressed within the window type Escape in place of
+    # both; a key held past the window types itself, and so does the one pressed after it.
+    ("combo of J and K types Escape",
+     [["+J"], ["+K"], ["-J"], ["-K"]],
+     [["+ESC"], ["-ESC"]],
+     {"ComboWindowTuning": 50}),
+    ("combo key held past the window types itself",
+     [["+J"], 100, ["+K"], ["-J", "-K"]],
+     [["+H"], ["+T"], ["-H", "-T"]],
+     {"ComboWindowTuning": 50}),
+
+    # Report coalescing (modal_keys/report_queue.cpp): a release queued behind the press of another
+    # key goes out with it, but a key typed twice keeps its release apart so the host sees two taps.
+    ("release coalesces into the next press",
+     [["+A"], ["-A"], ["+H"], ["-H"]],
+     [["+A"], ["-A", "+D"], ["-D"]]),
+    ("repeated key keeps its release",
+     [["+A"], ["-A"], ["+A"], ["-A"]],
+     [["+A"], ["-A"], ["+A"], ["-A"]]),
+
+    # Transform cache (modal_keys/transform_cache.cpp): a key typed again is served from the cache,
+    # and changing the layout (Escape+F1 selects the qwerty profile) drops what was cached for it.
+    ("key typed twice transforms the same",
+     [["+H"], ["-H"], ["+H"], ["-H"]],
+     [["+D"], ["-D"], ["+D"], ["-D"]]),
+    ("layout change invalidates the cache",
+     [["+H"], ["-H"], ["+ESC"], ["+F1"], ["-F1"], ["-ESC"], ["+H"], ["-H"], ["+H"], ["-H"]],
+     [["+D"], ["-D", "+H"], ["-H"], ["+H"], ["-H"]]),
+
+    # Passthrough (CanPassThrough in modal_keys/keymap.cpp): in the gaming profile (Escape+F3) plain
+    # keys go out unchanged, while a modifier sends the report through the GamingShift keymap.
+    ("gaming profile passes plain keys through",
+     [["+ESC"], ["+F3"], ["-F3"], ["-ESC"], ["+W"], ["+A"], ["-W", "-A"]],
+     [["+W"], ["+A"], ["-W", "-A"]]),
+    ("gaming profile maps keys with a modifier",
+     [["+ESC"], ["+F3"], ["-F3"], ["-ESC"], ["+LEFTSHIFT"], ["+W"], ["-W"], ["-LEFTSHIFT"]],
+     [["+LEFTSHIFT"], ["+2"], ["-LEFTSHIFT", "-2"]]),
+
+    # Shift conflicts (PressShiftConflicts in modal_keys/engine.cpp): shifted dvorak A needs RShift
+    # and H LShift, so pressed together A goes out first with its own shift. Keys that agree on
+    # the shift, like A and B, stay in one report.
+    ("keys needing different shifts are split",
+     [["+LEFTSHIFT"], ["+A", "+H"], ["-A", "-H"], ["-LEFTSHIFT"]],
+     [["+LEFTSHIFT"], ["-LEFTSHIFT", "+RIGHTSHIFT"], ["+A"], ["+LEFTSHIFT", "-RIGHTSHIFT"], ["+D"],
+      ["-LEFTSHIFT", "-A", "-D"]]),
+    ("keys needing the same shift stay together",
+     [["+LEFTSHIFT"], ["+A", "+B"], ["-A", "-B"], ["-LEFTSHIFT"]],
+     [["+LEFTSHIFT"], ["-LEFTSHIFT", "+RIGHTSHIFT"], ["+A", "+X"], ["+LEFTSHIFT", "-RIGHTSHIFT", "-A", "-X"],
+      ["-LEFTSHIFT"]]),
+
+    # One-shot modifiers (modal_keys/oneshot.cpp): tapping Q in the Alt layer arms Shift for the
+    # next key only, tapping it twice locks Shift until the next tap, and an armed Shift expires
+    # after OneShotTimeoutTuning.
+    ("one-shot shift applies to the next key",
+     [["+LEFTALT"], ["+Q"], ["-Q"], ["-LEFTALT"], ["+H"], ["-H"], ["+H"], ["-H"]],
+     [["+LEFTSHIFT"], ["-LEFTSHIFT"], ["+LEFTSHIFT"], ["+D"], ["-LEFTSHIFT", "-D"], ["+D"], ["-D"]]),
+    ("one-shot shift tapped twice locks",
+     [["+LEFTALT"], ["+Q"], ["-Q"], ["+Q"], ["-Q"], ["-LEFTALT"], ["+H"], ["-H"], ["+H"], ["-H"],
+      ["+LEFTALT"], ["+Q"], ["-Q"], ["-LEFTALT"], ["+H"], ["-H"]],
+     [["+LEFTSHIFT"], ["-LEFTSHIFT"], ["+LEFTSHIFT"], ["+D"], ["-LEFTSHIFT", "-D"], ["+LEFTSHIFT"], ["+D"],
+      ["-LEFTSHIFT", "-D"], ["+D"], ["-D"]]),
+    ("armed one-shot shift times out",
+     [["+LEFTALT"], ["+Q"], ["-Q"], ["-LEFTALT"], 400, ["+H"], ["-H"]],
+     [["+LEFTSHIFT"], ["-LEFTSHIFT"], ["+D"], ["-D"]],
+     {"OneShotTimeoutTuning": 200}),
+
+    # Leader sequences (modal_keys/leader.cpp): Escape+Space starts one, and dvorak "lq" (keys P, X)
+    # switches to qwerty without typing anything. Past LeaderTimeoutTuning the sequence is
+    # abandoned and the keys type again.
+    ("leader sequence switches the layout",
+     [["+ESC"], ["+SPACE"], ["-SPACE"], ["-ESC"], ["+P"], ["-P"], ["+X"], ["-X"], ["+H"], ["-H"]],
+     [["+H"], ["-H"]]),
+    ("leader sequence times out",
+     [["+ESC"], ["+SPACE"], ["-SPACE"], ["-ESC"], ["+P"], ["-P"], 400, ["+X"], ["-X"], ["+H"], ["-H"]],
+     [["+Q"], ["-Q", "+D"], ["-D"]],
+     {"LeaderTimeoutTuning": 200}),
+
+    # Macros (modal_keys/macros.cpp): Escape+R starts and stops recording what reaches the host,
+    # Escape+P plays it back a change per report once the keys are released. The pauses let the
+    # typed reports go out before the next command, as they would at typing speed. An erased
+    # EEPROM holds no macro, so playing types nothing.
+    ("macro records and plays back",
+     [["+ESC"], ["+R"], ["-R"], ["-ESC"], 20, ["+H"], ["-H"], ["+A"], ["-A"], 20,
+      ["+ESC"], ["+R"], ["-R"], ["-ESC"], 20, ["+ESC"], ["+P"], ["-P"], ["-ESC"], 300],
+     [["+D"], ["-D", "+A"], ["-A"], ["+D"], ["-D"], ["+A"], ["-A"]]),
+    ("macro playback without a recording types nothing",
+     [["+ESC"], ["+P"], ["-P"], ["-ESC"], 300, ["+H"], ["-H"]],
+     [["+D"], ["-D"]]),
+
+    # Abbreviations (tools/abbreviations.txt): typing ";ty" (dvorak Z, K, T) erases it and types
+    # "thank you". Any other key in between, even Backspace, breaks the match.
+    ("abbreviation expands",
+     [["+Z"], ["-Z"], ["+K"], ["-K"], ["+T"], ["-T"], 500],
+     [["+SEMICOLON"], ["-SEMICOLON", "+T"], ["-T", "+Y"], ["-Y"]]
+     + [["+BACKSPACE"], ["-BACKSPACE"]] * 3
+     + [[sign + key] for key in ["T", "H", "A", "N", "K", "SPACE", "Y", "O", "U"] for sign in "+-"]),
+    ("abbreviation broken by another key",
+     [["+Z"], ["-Z"], ["+K"], ["-K"], ["+BACKSPACE"], ["-BACKSPACE"], ["+T"], ["-T"], 500],
+     [["+SEMICOLON"], ["-SEMICOLON", "+T"], ["-T", "+BACKSPACE"], ["-BACKSPACE", "+Y"], ["-Y"]]),
+
+    # Home-row modifiers (modal_keys/home_row.cpp): A held for HomeRowHoldTuning on its own acts
+    # as Shift, while A tapped, or rolled into the next key, types itself. Each case starts with a
+    # pause so A doesn't count as typed in a burst with the start of the daemon.
+    ("home-row key held acts as a modifier",
+     [500, ["+A"], 400, ["+H"], ["-H"], ["-A"]],
+     [["+LEFTSHIFT"], ["+D"], ["-LEFTSHIFT", "-D"]],
+     {"HomeRowHoldTuning": 200}),
+    ("home-row key tapped types itself",
+     [500, ["+A"], ["-A"], 50],
+     [["+A"], ["-A"]],
+     {"HomeRowHoldTuning": 200}),
+    ("home-row key rolled into the next key types itself",
+     [500, ["+A"], ["+H"], ["-A"], ["-H"]],
+     [["+A"], ["-A", "+D"], ["-D"]],
+     {"HomeRowHoldTuning": 200}),
+
+    # Unplugging the keyboard (modal_keys/usb_watchdog.cpp) releases the keys it held right away,
+    # and the next keyboard starts from the entry point mode rather than the layer Alt was holding.
+    # The pauses give the watchdog time to see the keyboard running first.
+    ("unplugged keyboard releases its keys",
+     [["+H"], 300, "reconnect", ["+A"], ["-A"]],
+     [["+D"], ["-D"], ["+A"], ["-A"]]),
+    ("unplugged keyboard leaves its layer",
+     [["+LEFTALT"], 300, "reconnect", ["+H"], ["-H"]],
+     [["+D"], ["-D"]]),
+]
+
+
+def encode(reports):
+    data = b""
+    for report in reports:
+        for key in report:
+            data += EVENT.pack(0, 0, EV_KEY, KEYS[key[1:]], 1 if key[0] == "+" else 0)
+        data += EVENT.pack(0, 0, EV_SYN, 0, 0)
+    return data
+
+
+def decode(data):
+    reports, report = [], []
+    for offset in range(0, len(data), EVENT.size):
+        _, _, kind, code, value = EVENT.unpack_from(data, offset)
+        if kind == EV_SYN:
+            if report:
+                reports.append(report)
+            report = []
+        elif kind == EV_KEY:
+            report.append(("+" if value else "-") + NAMES.get(code, str(code)))
+    return reports
+
+
+def tuning_ids():
+    # the TuningId enum of modal_keys/tuning.h, in order
+    with open(os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "modal_keys", "tuning.h")) as f:
+        body = f.read().split("typedef enum {")[1].split("}")[0]
+    names = [line.split("//")[0].strip().rstrip(",").split(" ")[0] for line in body.splitlines()]
+    return {name: i for i, name in enumerate(name for name in names if name)}
+
+
+def write_eeprom(path, tunings):
+    data = bytearray([0xFF] * EEPROM_SIZE)
+    ids = tuning_ids()
+    for name, value in tunings.items():
+        struct.pack_into("<H", data, TUNINGS_SLOT + 2 * ids[name], value)
+    with open(path, "wb") as f:
+        f.write(data)
+
+
+def run(daemon, steps, tunings):
+    with tempfile.TemporaryDirectory() as directory:
+        input_path = os.path.join(directory, "input")
+        output_path = os.path.join(directory, "output")
+        eeprom_path = os.path.join(directory, "eeprom")
+        write_eeprom(eeprom_path, tunings)
+        command = [daemon, "--input", input_path, "--output", output_path, "--eeprom", eeprom_path]
+        if all(isinstance(step, list) for step in steps):
+            with open(input_path, "wb") as f:
+                f.write(encode(steps))
+            subprocess.run(command, check=True, stderr=subprocess.DEVNULL)
+        else:
+            os.mkfifo(input_path)
+            # with --reopen the end of the FIFO is the keyboard going away, and doesn't end the daemon
+            reconnects = "reconnect" in steps
+            if reconnects:
+                command.append("--reopen")
+            daemon_process = subprocess.Popen(command, stderr=subprocess.DEVNULL)
+            f = open(input_path, "wb", buffering=0)
+            for step in steps:
+                if isinstance(step, list):
+                    f.write(encode([step]))
+                elif step == "reconnect":
+                    f.close()
+                    time.sleep(RECONNECT_SECONDS)
+                    # blocks until the daemon has opened the FIFO again
+                    f = open(input_path, "wb", buffering=0)
+                else:
+                    time.sleep(step / 1000.0)
+            f.close()
+            if reconnects:
+                time.sleep(RECONNECT_SECONDS)
+                daemon_process.send_signal(signal.SIGTERM)
+            if daemon_process.wait(timeout=10):
+                raise SystemExit("%s failed" % daemon)
+        with open(output_path, "rb") as f:
+            return decode(f.read())
+
+
+def main():
+    daemon = sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(__file__), "modal_keys_daemon")
+    failed = 0
+    for case in CASES:
+        name, steps, expected = case[:3]
+        actual = run(daemon, steps, case[3] if len(case) > 3 else {})
+        if actual != expected:
+            failed += 1
+            print("FAIL %s\n  expected %s\n  got      %s" % (name, expected, actual))
+    print("%d of %d cases passed" % (len(CASES) - failed, len(CASES)))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,209 @@
+// Injects the output reports of a sketch built without LEONARDO: they arrive over the serial port
+// as OutputReportFrame frames (see modal_keys/commands.h) and go to a uinput device, like the
+// daemon's. Everything between frames is the sketch's log text. The host's LEDs on the uinput
+// device go back to the sketch as SetHostLedsCommand frames.
+
+#include "modal_keys.h"
+#include "commands.h"
+#include "framing.h"
+#include "uinput_output.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define DefaultBaudRate 115200
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+volatile sig_atomic_t Running = 1;
+
+FrameParser ReportParser;
+bool LogToStderr = false;
+
+bool HaveSequence = false;
+uint8_t NextSequence = 0;
+
+uint32_t ReportsReceived = 0;
+uint32_t ReportsLost = 0;
+uint32_t FramesCorrupt = 0;
+
+// ****************************************************************************
+// Helper Functions
+// ****************************************************************************
+
+void HandleSignal(int signal) {
+    Running = 0;
+}
+
+speed_t BaudRateToSpeed(long baud) {
+    switch (baud) {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 500000: return B500000;
+        case 1000000: return B1000000;
+        case 2000000: return B2000000;
+    }
+    return 0;
+}
+
+int OpenPort(const char *path, long baud) {
+    struct stat info;
+    if (stat(path, &info) < 0) {
+        perror(path);
+        return -1;
+    }
+    // a capture of the stream, for testing, is only read
+    int fd = open(path, (S_ISCHR(info.st_mode) ? O_RDWR : O_RDONLY) | O_NOCTTY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    struct termios settings;
+    if (!isatty(fd)) return fd;
+    if (tcgetattr(fd, &settings) < 0) {
+        perror(path);
+        return -1;
+    }
+    cfmakeraw(&settings);
+    cfsetspeed(&settings, BaudRateToSpeed(baud));
+    tcsetattr(fd, TCSANOW, &settings);
+    return fd;
+}
+
+void HandleReportFrame(const FrameParser &frame) {
+    if (frame.type != OutputReportFrame || frame.length != 9) return;     // command responses
+    uint8_t sequence = FramePayload(frame)[0];
+    // every report is a complete state, so the latest one is right even after a loss; the keys
+    // pressed and released in between are what's lost
+    if (HaveSequence && sequence != NextSequence) {
+        uint8_t lost = sequence - NextSequence;
+        ReportsLost += lost;
+        fprintf(stderr, "lost %u report(s) before #%u\n", lost, sequence);
+    }
+    HaveSequence = true;
+    NextSequence = sequence + 1;
+    ReportsReceived++;
+
+    uint8_t report[8];
+    for (uint8_t i = 0; i < 8; i++) report[i] = FramePayload(frame)[1 + i];
+    SendKeysToHost(report);
+}
+
+void ForwardHostLeds() {
+    uint8_t leds;
+    if (ReadHostLeds(leds) && Serial.controlFd >= 0) WriteFrame(SetHostLedsCommand, &leds, 1);
+}
+
+void ReceiveBytes(const uint8_t *data, ssize_t length) {
+    for (ssize_t n = 0; n < length; n++) {
+        if (FrameParserIdle(ReportParser) && data[n] != FrameStart) {
+            if (LogToStderr) fputc(data[n], stderr);
+            continue;
+        }
+        switch (FeedFrameParser(ReportParser, data[n])) {
+            case FrameComplete:
+                HandleReportFrame(ReportParser);
+                break;
+            case FrameCorrupt:
+                FramesCorrupt++;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void PrintUsage(const char *name) {
+    fprintf(stderr,
+        "usage: %s --port PATH [options]\n"
+        "  -p, --port PATH      serial port of the sketch (e.g. /dev/ttyUSB0), or a capture of it\n"
+        "  -b, --baud RATE      baud rate (default %d, as in the sketch's setup())\n"
+        "  -o, --output PATH    " UinputPath " (default) creates a virtual keyboard, any other path\n"
+        "                       receives struct input_event records\n"
+        "  -l, --log            write the sketch's log text to stderr\n", name, DefaultBaudRate);
+}
+
+// ****************************************************************************
+// Main
+// ****************************************************************************
+
+int main(int argc, char *argv[]) {
+    const char *portPath = NULL;
+    const char *outputPath = UinputPath;
+    long baud = DefaultBaudRate;
+
+    static const struct option options[] = {
+        { "port", required_argument, NULL, 'p' },
+        { "baud", required_argument, NULL, 'b' },
+        { "output", required_argument, NULL, 'o' },
+        { "log", no_argument, NULL, 'l' },
+        { NULL, 0, NULL, 0 }
+    };
+    for (int option; (option = getopt_long(argc, argv, "p:b:o:l", options, NULL)) != -1; ) {
+        switch (option) {
+            case 'p': portPath = optarg; break;
+            case 'b': baud = strtol(optarg, NULL, 10); break;
+            case 'o': outputPath = optarg; break;
+            case 'l': LogToStderr = true; break;
+            default:
+                PrintUsage(argv[0]);
+                return 2;
+        }
+    }
+    if (!portPath || !BaudRateToSpeed(baud)) {
+        PrintUsage(argv[0]);
+        return 2;
+    }
+
+    int portFd = OpenPort(portPath, baud);
+    if (portFd < 0 || !OpenOutput(outputPath)) return 1;
+    ResetFrameParser(ReportParser);
+    // WriteFrame writes through Serial
+    if (isatty(portFd)) Serial.controlFd = portFd;
+
+    // no SA_RESTART: a signal interrupts the blocking poll
+    struct sigaction action = {};
+    action.sa_handler = HandleSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    while (Running) {
+        struct pollfd ready[2] = { { portFd, POLLIN, 0 }, { HostLedFd(), POLLIN, 0 } };
+        if (poll(ready, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+        if (ready[1].revents & POLLIN) ForwardHostLeds();
+        if (!ready[0].revents) continue;
+
+        uint8_t data[256];
+        ssize_t length = read(portFd, data, sizeof(data));
+        if (length < 0 && errno == EINTR) continue;
+        if (length <= 0) {
+            if (length < 0) perror(portPath);
+            break;
+        }
+        ReceiveBytes(data, length);
+    }
+
+    // releases whatever is still pressed
+    CloseOutput();
+    fprintf(stderr, "%u reports, %u lost, %u corrupt frames\n", ReportsReceived, ReportsLost, FramesCorrupt);
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include "uinput_output.h"
+#include "evdev_keys.h"
+#include "modal_keys.h"
+#include "helpers.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <linux/uinput.h>
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+int OutputFd = -1;
+bool OutputIsUinput = false;
+
+// the state the host currently has
+uint8_t HostReport[8] = { 0 };
+// the LEDs the host has set on the virtual keyboard, as HID LED bits
+uint8_t HostLedState = 0;
+
+// ****************************************************************************
+// Helper Functions
+// ****************************************************************************
+
+void WriteEvent(uint16_t type, uint16_t code, int32_t value) {
+    struct input_event event;
+    memset(&event, 0, sizeof(event));
+    gettimeofday(&event.time, NULL);
+    event.type = type;
+    event.code = code;
+    event.value = value;
+    if (write(OutputFd, &event, sizeof(event)) != sizeof(event)) perror("output");
+}
+
+bool CreateUinputDevice() {
+    ioctl(OutputFd, UI_SET_EVBIT, EV_KEY);
+    ioctl(OutputFd, UI_SET_EVBIT, EV_REP);     // let the kernel do key repeat, as a host does for USB keyboards
+    for (uint8_t usage = 0; usage <= MaxHidUsage; usage++) {
+        if (HidUsageToEvdev(usage)) ioctl(OutputFd, UI_SET_KEYBIT, HidUsageToEvdev(usage));
+    }
+    for (uint8_t bit = 0; bit < 8; bit++) {
+        ioctl(OutputFd, UI_SET_KEYBIT, ModifierToEvdev(1 << bit));
+    }
+    // the host's lock state comes back as LED events
+    ioctl(OutputFd, UI_SET_EVBIT, EV_LED);
+    for (uint8_t bit = 0; bit < NumHidLeds; bit++) {
+        ioctl(OutputFd, UI_SET_LEDBIT, LedToEvdev(1 << bit));
+    }
+
+    struct uinput_setup setup;
+    memset(&setup, 0, sizeof(setup));
+    setup.id.bustype = BUS_USB;
+    setup.id.vendor = 0x2341;       // Arduino Leonardo
+    setup.id.product = 0x8036;
+    strncpy(setup.name, "ArduinoModalKeys", UINPUT_MAX_NAME_SIZE - 1);
+    if (ioctl(OutputFd, UI_DEV_SETUP, &setup) < 0 || ioctl(OutputFd, UI_DEV_CREATE) < 0) {
+        perror("uinput");
+        return false;
+    }
+    return true;
+}
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+bool OpenOutput(const char *path) {
+    OutputIsUinput = strcmp(path, UinputPath) == 0;
+    OutputFd = open(path, OutputIsUinput ? O_RDWR | O_NONBLOCK : O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (OutputFd < 0) {
+        perror(path);
+        return false;
+    }
+    return !OutputIsUinput || CreateUinputDevice();
+}
+
+// release everything the host still has pressed, then remove the device
+void CloseOutput() {
+    if (OutputFd < 0) return;
+    uint8_t released[8] = { 0 };
+    SendKeysToHost(released);
+    if (OutputIsUinput) ioctl(OutputFd, UI_DEV_DESTROY);
+    close(OutputFd);
+    OutputFd = -1;
+}
+
+int HostLedFd() {
+    return OutputIsUinput ? OutputFd : -1;
+}
+
+// Read the LED events the host wrote to the virtual keyboard; true if there were any.
+bool ReadHostLeds(uint8_t &leds) {
+    struct input_event events[16];
+    ssize_t length = read(OutputFd, events, sizeof(events));
+    bool changed = false;
+    for (ssize_t n = 0; n < length / (ssize_t)sizeof(struct input_event); n++) {
+        if (events[n].type != EV_LED) continue;
+        uint8_t led = EvdevToLed(events[n].code);
+        if (events[n].value) HostLedState |= led;
+        else HostLedState &= ~led;
+        changed = true;
+    }
+    leds = HostLedState;
+    return changed;
+}
+
+// Write the difference to the last report as key events: modifiers, then released keys, then pressed keys.
+void SendKeysToHost(uint8_t buf[8]) {
+    if (OutputFd < 0) return;
+    bool changed = false;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+        uint8_t mod = 1 << bit;
+        if ((buf[0] ^ HostReport[0]) & mod) {
+            WriteEvent(EV_KEY, ModifierToEvdev(mod), (buf[0] & mod) ? 1 : 0);
+            changed = true;
+        }
+    }
+    for (uint8_t i = 2; i < 8; i++) {
+        if (HostReport[i] && !IsKeyPressedInBuffer(HostReport[i], buf) && HidUsageToEvdev(HostReport[i])) {
+            WriteEvent(EV_KEY, HidUsageToEvdev(HostReport[i]), 0);
+            changed = true;
+        }
+    }
+    for (uint8_t i = 2; i < 8; i++) {
+        if (buf[i] && !IsKeyPressedInBuffer(buf[i], HostReport) && HidUsageToEvdev(buf[i])) {
+            WriteEvent(EV_KEY, HidUsageToEvdev(buf[i]), 1);
+            changed = true;
+        }
+    }
+    if (changed) WriteEvent(EV_SYN, SYN_REPORT, 0);
+    CopyBuf(buf, HostReport);
+}
@@ -0,0 +1,16 @@
+#if !defined(__UINPUT_OUTPUT_H_)
+#define __UINPUT_OUTPUT_H_
+
+#include <Arduino.h>
+
+#define UinputPath "/dev/uinput"
+
+// Output reports become key events. With UinputPath a virtual keyboard is created; any other
+// path (a file or a pipe) receives the raw struct input_event records instead.
+extern bool OpenOutput(const char *path);
+extern void CloseOutput();
+// the virtual keyboard's file descriptor while there is one, to poll for the host's LED events
+extern int HostLedFd();
+extern bool ReadHostLeds(uint8_t &leds);
+
+#endif // __UINPUT_OUTPUT_H_
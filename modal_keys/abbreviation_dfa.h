@@ -0,0 +1,88 @@
+#if !defined(__ABBREVIATION_DFA_H_)
+#define __ABBREVIATION_DFA_H_
+
+// generated by tools/abbreviations.py from tools/abbreviations.txt, don't edit
+
+#include "abbreviations.h"
+
+#define NumAbbreviationClasses 15
+
+// class of each key | AbbreviationClassShift if shifted
+const uint8_t AbbreviationClasses[2 * AbbreviationClassShift] PROGMEM = {
+     0,  0,  0,  0,  1,  2,  0,  0,  3,  4,  5,  0,  6,  0,  7,  8,
+     9,  0, 10,  0,  0,  0,  0, 11,  0,  0, 12,  0, 13,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0, 14,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+};
+
+// next state by state and class
+const uint8_t AbbreviationNext[][NumAbbreviationClasses] PROGMEM = {
+    /*   0 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+    /*   1 */ { 0, 5, 2, 21, 0, 0, 10, 0, 17, 0, 0, 13, 0, 0, 1 },
+    /*   2 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 0, 0, 1 },
+    /*   3 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 4, 0, 1 },
+    /*   4 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+    /*   5 */ { 0, 0, 0, 0, 6, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+    /*   6 */ { 0, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+    /*   7 */ { 0, 0, 0, 0, 0, 0, 8, 0, 0, 0, 0, 0, 0, 0, 1 },
+    /*   8 */ { 0, 0, 0, 0, 0, 0, 0, 9, 0, 0, 0, 0, 0, 0, 1 },
+    /*   9 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+    /*  10 */ { 0, 0, 0, 23, 0, 0, 0, 0, 0, 11, 0, 0, 0, 0, 1 },
+    /*  11 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 12, 0, 0, 0, 1 },
+    /*  12 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+    /*  13 */ { 0, 0, 0, 0, 0, 0, 14, 0, 0, 0, 0, 0, 0, 16, 1 },
+    /*  14 */ { 0, 15, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+    /*  15 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+    /*  16 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+    /*  17 */ { 0, 0, 0, 0, 0, 18, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+    /*  18 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 19, 0, 0, 1 },
+    /*  19 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 20, 0, 0, 0, 0, 1 },
+    /*  20 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+    /*  21 */ { 0, 0, 0, 0, 0, 22, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+    /*  22 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+    /*  23 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+};
+
+// the abbreviation (index + 1) each state completes, or 0
+const uint8_t AbbreviationMatches[] PROGMEM = {
+    0, 0, 0, 0, 1, 0, 0, 0, 0, 2, 0, 0, 3, 0, 0, 4,
+    5, 0, 0, 0, 6, 0, 7, 8,
+};
+
+// by abbreviation: keys to erase, offset of the expansion in AbbreviationTexts
+const AbbreviationExpansion AbbreviationExpansions[] PROGMEM = {
+    /* ;btw     */ { 4, 0 },
+    /* ;afaik   */ { 6, 11 },
+    /* ;imo     */ { 4, 28 },
+    /* ;tia     */ { 4, 42 },
+    /* ;ty      */ { 3, 60 },
+    /* ;lgtm    */ { 5, 70 },
+    /* ;eg      */ { 3, 87 },
+    /* ;ie      */ { 3, 92 },
+};
+
+// keystrokes, key | ShiftedKeystroke if shifted, each expansion ending with 0
+const uint8_t AbbreviationTexts[] PROGMEM = {
+    // by the way
+    0x05, 0x1C, 0x2C, 0x17, 0x0B, 0x08, 0x2C, 0x1A, 0x04, 0x1C, 0x00,
+    // as far as I know
+    0x04, 0x16, 0x2C, 0x09, 0x04, 0x15, 0x2C, 0x04, 0x16, 0x2C, 0x8C, 0x2C, 0x0E, 0x11, 0x12, 0x1A, 0x00,
+    // in my opinion
+    0x0C, 0x11, 0x2C, 0x10, 0x1C, 0x2C, 0x12, 0x13, 0x0C, 0x11, 0x0C, 0x12, 0x11, 0x00,
+    // thanks in advance
+    0x17, 0x0B, 0x04, 0x11, 0x0E, 0x16, 0x2C, 0x0C, 0x11, 0x2C, 0x04, 0x07, 0x19, 0x04, 0x11, 0x06, 0x08, 0x00,
+    // thank you
+    0x17, 0x0B, 0x04, 0x11, 0x0E, 0x2C, 0x1C, 0x12, 0x18, 0x00,
+    // looks good to me
+    0x0F, 0x12, 0x12, 0x0E, 0x16, 0x2C, 0x0A, 0x12, 0x12, 0x07, 0x2C, 0x17, 0x12, 0x2C, 0x10, 0x08, 0x00,
+    // e.g.
+    0x08, 0x37, 0x0A, 0x37, 0x00,
+    // i.e.
+    0x0C, 0x37, 0x08, 0x37, 0x00,
+};
+
+#endif // __ABBREVIATION_DFA_H_
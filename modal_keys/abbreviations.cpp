@@ -0,0 +1,46 @@
+#include "modal_keys.h"
+#include "abbreviations.h"
+#include "abbreviation_dfa.h"
+#include "helpers.h"
+#include "typing.h"
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+uint8_t AbbreviationState = 0;
+
+// ****************************************************************************
+// Helper Functions
+// ****************************************************************************
+
+uint8_t AbbreviationClassFor(uint8_t key, uint8_t mods) {
+    if (key >= AbbreviationClassShift || (mods & ~(LShift | RShift))) return 0;
+    uint8_t shifted = (mods & (LShift | RShift)) ? AbbreviationClassShift : 0;
+    return pgm_read_byte(&AbbreviationClasses[key | shifted]);
+}
+
+void ExpandAbbreviation(uint8_t index) {
+    AbbreviationExpansion expansion;
+    memcpy_P(&expansion, &AbbreviationExpansions[index], sizeof(AbbreviationExpansion));
+    if (TypeText(expansion.erase, &AbbreviationTexts[expansion.offset]))
+        Log(F("abbreviation "), String(index));
+}
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+// called with each report sent for a key typed, and the report before it
+void FeedAbbreviations(uint8_t buf[8], uint8_t prevbuf[8]) {
+    for (uint8_t i = 2; i < 8; i++) {
+        if (!buf[i] || IsKeyPressedInBuffer(buf[i], prevbuf)) continue;
+        uint8_t keyClass = AbbreviationClassFor(buf[i], buf[0]);
+        AbbreviationState = pgm_read_byte(&AbbreviationNext[AbbreviationState][keyClass]);
+        uint8_t match = pgm_read_byte(&AbbreviationMatches[AbbreviationState]);
+        if (match) {
+            ExpandAbbreviation(match - 1);
+            AbbreviationState = 0;
+        }
+    }
+}
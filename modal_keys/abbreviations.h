@@ -0,0 +1,27 @@
+#if !defined(__ABBREVIATIONS_H_)
+#define __ABBREVIATIONS_H_
+
+#include <Arduino.h>
+
+// Abbreviations: typing e.g. ";btw" erases it with backspaces and types "by the way" instead.
+// The keys sent to the host are fed to an automaton in flash (abbreviation_dfa.h, compiled from
+// tools/abbreviations.txt by tools/abbreviations.py), which finds every abbreviation as its last
+// key is typed: one table lookup per key, and nothing is held back while typing. The expansion
+// is typed from TypingTask (see typing.h).
+//
+// The automaton works on key combos as the host sees them, after the layout, so abbreviations
+// are the same characters with every layout. Keys with modifiers other than shift start the
+// match over. The keys of the gaming fast path and of the typing queue itself aren't fed to it.
+
+// a key's class is looked up by key | AbbreviationClassShift if shifted; keys from here up
+// are in no abbreviation
+#define AbbreviationClassShift 0x40
+
+struct AbbreviationExpansion {
+    uint8_t erase;          // keys typed for the abbreviation
+    uint16_t offset;        // of the expansion in AbbreviationTexts
+};
+
+extern void FeedAbbreviations(uint8_t buf[8], uint8_t prevbuf[8]);
+
+#endif // __ABBREVIATIONS_H_
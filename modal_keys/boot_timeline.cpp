@@ -0,0 +1,34 @@
+#include "modal_keys.h"
+#include "boot_timeline.h"
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+uint32_t BootTimeline[NumBootStages] = { 0 };
+
+bool HostIsReady = false;
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+// the first time only
+void NoteBootStage(BootStage stage) {
+    if (BootTimeline[stage]) return;
+    uint32_t now = micros();
+    BootTimeline[stage] = now ? now : 1;
+}
+
+uint32_t GetBootStageMicros(uint8_t stage) {
+    return BootTimeline[stage];
+}
+
+// True until the platform's HostReady() says reports would reach the computer; polled until then.
+bool WaitingForHost() {
+    if (HostIsReady) return false;
+    if (!HostReady()) return true;
+    HostIsReady = true;
+    NoteBootStage(HostReadyStage);
+    return false;
+}
@@ -0,0 +1,30 @@
+#if !defined(__BOOT_TIMELINE_H_)
+#define __BOOT_TIMELINE_H_
+
+#include <Arduino.h>
+
+// When each step from reset to the first keystroke happened, in us since reset (0 until it has),
+// for GetBootStageCommand. setup() starts the keyboard's enumeration first and loads the
+// configuration while it runs; nothing waits with a fixed delay. Reports from the keyboard that
+// arrive before the computer has configured the Arduino as a keyboard wait in the input queue and
+// are typed once it has. The queue holds 16 keystrokes (see InputQueueSize in engine.cpp); after
+// that the keys pressed and released before the host is ready are lost, and those still held when
+// it is go through.
+// Ids are part of the serial protocol: only ever append new ones.
+typedef enum {
+    SetupStartedStage = 0,      // setup() entered, after the bootloader and the core's USB init
+    UsbHostStartedStage,        // the host controller is looking for the keyboard
+    StateLoadedStage,           // the configuration is loaded from EEPROM
+    SetupDoneStage,
+    HostReadyStage,             // the computer has configured the Arduino as a keyboard
+    KeyboardReadyStage,         // the keyboard is enumerated and polled
+    FirstInputStage,            // the first report from the keyboard
+    FirstOutputStage,           // the first report to the computer
+    NumBootStages
+} BootStage;
+
+extern void NoteBootStage(BootStage stage);
+extern uint32_t GetBootStageMicros(uint8_t stage);
+extern bool WaitingForHost();
+
+#endif // __BOOT_TIMELINE_H_
@@ -0,0 +1,224 @@
+#include "modal_keys.h"
+#include "combos.h"
+#include "keymap.h"
+#include "helpers.h"
+#include "home_row.h"
+#include "stats.h"
+#include "tuning.h"
+
+// ****************************************************************************
+// Constants
+// ****************************************************************************
+
+const Combo Combos[] PROGMEM = {
+    { { _J, _K, 0 },            ComboKey,   0,      _Escape },
+    { { _D, _F, 0 },            ComboKey,   0,      _CapsLock },
+};
+
+#define NumCombos (sizeof(Combos) / sizeof(Combo))
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+// physical report as last received
+uint8_t LastRawBuffer[8] = { 0 };
+// report as last passed on to the mode engine
+uint8_t LastFilteredBuffer[8] = { 0 };
+
+// keys held back because they could still become part of a combo
+uint8_t PendingKeys[MaxComboKeys] = { 0 };
+uint8_t NumPendingKeys = 0;
+uint32_t PendingSince = 0;
+
+// keys of the last fired combo that are still held; they stay hidden from the mode engine until released
+uint8_t ComboHeldKeys[MaxComboKeys] = { 0 };
+// key standing in for the fired combo until the first of its keys is released
+uint8_t ComboSubstituteKey = 0;
+
+// ****************************************************************************
+// Helper Functions
+// ****************************************************************************
+
+Combo ReadCombo(uint8_t index) {
+    Combo combo;
+    memcpy_P(&combo, &Combos[index], sizeof(Combo));
+    return combo;
+}
+
+bool IsInKeyList(uint8_t key, const uint8_t *keys, uint8_t count) {
+    if (!key) return false;
+    for (uint8_t i = 0; i < count; i++) {
+        if (keys[i] == key) return true;
+    }
+    return false;
+}
+
+bool IsPendingKey(uint8_t key) {
+    return IsInKeyList(key, PendingKeys, NumPendingKeys);
+}
+
+// combos only apply to plain typing, so they never get in the way of modifier chords
+bool CombosActive(uint8_t buf[8]) {
+    if (Tunings[ComboWindowTuning] == 0 || buf[0]) return false;
+    switch (CurrentMode) {
+        case NormalTypingMode:
+        case ModalTypingMode:
+            return true;
+        default:
+            break;
+    }
+    return CurrentMode == EntryPointMode;
+}
+
+// true if `key` together with the pending keys is still a subset of some combo
+// whose remaining keys have not been pressed yet
+bool CouldCompleteCombo(uint8_t key, uint8_t buf[8]) {
+    for (uint8_t c = 0; c < NumCombos; c++) {
+        Combo combo = ReadCombo(c);
+        if (!IsInKeyList(key, combo.keys, MaxComboKeys)) continue;
+        bool possible = true;
+        for (uint8_t p = 0; p < NumPendingKeys; p++) {
+            if (!IsInKeyList(PendingKeys[p], combo.keys, MaxComboKeys)) possible = false;
+        }
+        for (uint8_t k = 0; k < MaxComboKeys; k++) {
+            uint8_t member = combo.keys[k];
+            if (member && member != key && !IsPendingKey(member) && IsKeyPressedInBuffer(member, buf))
+                possible = false;
+        }
+        if (possible) return true;
+    }
+    return false;
+}
+
+// returns the index of the combo made up of exactly the pending keys, or -1
+int8_t FindCompletedCombo() {
+    for (uint8_t c = 0; c < NumCombos; c++) {
+        Combo combo = ReadCombo(c);
+        uint8_t members = 0;
+        bool complete = true;
+        for (uint8_t k = 0; k < MaxComboKeys; k++) {
+            if (!combo.keys[k]) continue;
+            members++;
+            if (!IsPendingKey(combo.keys[k])) complete = false;
+        }
+        if (complete && members == NumPendingKeys) return c;
+    }
+    return -1;
+}
+
+// The report the mode engine sees: pending and fired combo keys are removed, keeping the
+// order of the remaining keys, and a combo's substitute key takes the place of its first key.
+void BuildFilteredBuffer(uint8_t raw[8], uint8_t filtered[8]) {
+    filtered[0] = raw[0];
+    filtered[1] = raw[1];
+    uint8_t j = 2;
+    bool substituted = false;
+    for (uint8_t i = 2; i < 8; i++) {
+        uint8_t key = raw[i];
+        if (!key) continue;
+        if (IsInKeyList(key, ComboHeldKeys, MaxComboKeys)) {
+            if (ComboSubstituteKey && !substituted) filtered[j++] = ComboSubstituteKey;
+            substituted = true;
+        } else if (!IsPendingKey(key)) {
+            filtered[j++] = key;
+        }
+    }
+    while (j < 8) filtered[j++] = 0;
+}
+
+void PassOn(uint8_t raw[8]) {
+    uint8_t filtered[8];
+    BuildFilteredBuffer(raw, filtered);
+    if (EqualBuffers(filtered, LastFilteredBuffer)) return;
+    CopyBuf(filtered, LastFilteredBuffer);
+    FilterHomeRowMods(filtered);
+}
+
+// stop holding back the pending keys: the mode engine sees them as they were pressed
+void FlushPendingKeys() {
+    if (!NumPendingKeys) return;
+    NumPendingKeys = 0;
+    CountStat(ComboFlushesStat);
+    PassOn(LastRawBuffer);
+}
+
+void FireCombo(uint8_t index) {
+    Combo combo = ReadCombo(index);
+    CountStat(CombosFiredStat);
+    for (uint8_t k = 0; k < MaxComboKeys; k++) {
+        ComboHeldKeys[k] = combo.keys[k];
+    }
+    NumPendingKeys = 0;
+    switch (combo.action) {
+        case ComboKey:
+            ComboSubstituteKey = combo.value;
+            break;
+        case ComboTap:
+            ComboSubstituteKey = 0;
+            PressAndReleaseKey((RichKey){ combo.mods, combo.value });
+            break;
+    }
+}
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+// Sits in front of the mode engine. Keys that can't be part of a combo are passed on straight
+// away; only keys that could still complete one are held back, for at most the combo window.
+void FilterCombos(uint8_t buf[8]) {
+    // keys released: a held back key that is released was just typed, a fired combo ends
+    for (uint8_t i = 2; i < 8; i++) {
+        uint8_t key = LastRawBuffer[i];
+        if (!key || IsKeyPressedInBuffer(key, buf)) continue;
+        if (IsPendingKey(key)) FlushPendingKeys();
+        for (uint8_t k = 0; k < MaxComboKeys; k++) if (ComboHeldKeys[k] == key) {
+            ComboHeldKeys[k] = 0;
+            ComboSubstituteKey = 0;
+        }
+    }
+
+    // keys pressed: hold back the ones that could still complete a combo
+    bool active = CombosActive(buf);
+    for (uint8_t i = 2; i < 8; i++) {
+        uint8_t key = buf[i];
+        if (!key || IsKeyPressedInBuffer(key, LastRawBuffer)) continue;
+        if (active && NumPendingKeys < MaxComboKeys && CouldCompleteCombo(key, buf)) {
+            if (!NumPendingKeys) PendingSince = millis();
+            PendingKeys[NumPendingKeys++] = key;
+            CountStat(ComboKeysHeldStat);
+        } else {
+            // anything else typed while keys are held back means they weren't a combo
+            FlushPendingKeys();
+        }
+    }
+    if (!active) FlushPendingKeys();
+
+    int8_t combo = FindCompletedCombo();
+    if (NumPendingKeys && combo >= 0) FireCombo(combo);
+
+    CopyBuf(buf, LastRawBuffer);
+    PassOn(buf);
+}
+
+// Called from loop(): lets held back keys through once the combo window has passed.
+void ComboTask() {
+    if (NumPendingKeys && millis() - PendingSince >= Tunings[ComboWindowTuning])
+        FlushPendingKeys();
+}
+
+// true while keys are held back waiting for the combo window to pass
+bool CombosPending() {
+    return NumPendingKeys != 0;
+}
+
+void ResetCombos() {
+    memset(LastRawBuffer, 0, sizeof(LastRawBuffer));
+    memset(LastFilteredBuffer, 0, sizeof(LastFilteredBuffer));
+    NumPendingKeys = 0;
+    ComboSubstituteKey = 0;
+    for (uint8_t k = 0; k < MaxComboKeys; k++) {
+        ComboHeldKeys[k] = 0;
+    }
+}
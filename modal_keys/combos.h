@@ -0,0 +1,27 @@
+#if !defined(__COMBOS_H_)
+#define __COMBOS_H_
+
+#include <Arduino.h>
+#include "keys.h"
+
+#define MaxComboKeys 3
+
+// what happens when all keys of a combo are pressed within the combo window
+typedef enum {
+    ComboKey = 0,       // the combo acts as one physical key (value) for the mode engine, e.g. _Escape or _CapsLock
+    ComboTap            // tap the output key (mods, value) straight to the host
+} ComboAction;
+
+struct Combo {
+    uint8_t keys[MaxComboKeys]; // physical scancodes, unused entries are 0
+    uint8_t action;
+    uint8_t mods;
+    uint8_t value;
+};
+
+extern void FilterCombos(uint8_t buf[8]);
+extern void ComboTask();
+extern bool CombosPending();
+extern void ResetCombos();
+
+#endif // __COMBOS_H_
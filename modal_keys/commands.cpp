@@ -0,0 +1,328 @@
+#include "modal_keys.h"
+#include "commands.h"
+#include "boot_timeline.h"
+#include "framing.h"
+#include "keymap.h"
+#include "keymap_vm.h"
+#include "leds.h"
+#include "helpers.h"
+#include "profiles.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "tuning.h"
+#include "usage.h"
+
+// upper bound on the serial bytes consumed by one call, so parsing never holds up the key path
+#define MaxCommandBytesPerCall 16
+
+// number of stats / keyspecs that fit into one frame
+#define MaxStatsPerFrame ((MaxFramePayload - 4) / 4)
+#define MaxKeySpecsPerFrame ((MaxFramePayload - 2) / 4)
+#define MaxUsageCountersPerFrame ((MaxFramePayload - 5) / 4)
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+FrameParser CommandParser;
+uint8_t ResponsePayload[MaxFramePayload];
+uint8_t OutputReportSequence = 0;
+
+// ****************************************************************************
+// Command Implementations
+// ****************************************************************************
+
+void PutUint32(uint8_t *out, uint32_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+}
+
+bool IsEntryPointMode(uint8_t mode) {
+    switch (mode) {
+        case NormalNoKeysMode:
+        case ModalNoKeysMode:
+        case GamingNoKeysMode:
+        case BlackDesertNoKeysMode:
+        case CustomMode1:
+        case CustomMode2:
+        case CustomMode3:
+        case CustomMode4:
+            return true;
+    }
+    return false;
+}
+
+uint8_t Ping(uint8_t *response) {
+    response[1] = ProtocolVersion;
+    response[2] = NumStats;
+    response[3] = NumModes;
+    return 4;
+}
+
+uint8_t GetConfig(uint8_t *response) {
+    response[1] = CurrentOSMode;
+    response[2] = CurrentLayout;
+    response[3] = EntryPointMode;
+    response[4] = CurrentMode;
+    response[5] = WriteToLog;
+    response[6] = CurrentProfile;
+    return 7;
+}
+
+uint8_t SetConfig(const uint8_t *args, uint8_t length) {
+    if (length != 3) return CommandBadLength;
+    uint8_t osMode = args[0];
+    uint8_t layout = args[1];
+    uint8_t entryPointMode = args[2];
+    if (osMode != Unchanged && osMode > OSX) return CommandBadArgument;
+    if (layout != Unchanged && layout > custom) return CommandBadArgument;
+    if (entryPointMode != Unchanged && !IsEntryPointMode(entryPointMode)) return CommandBadArgument;
+
+    if (osMode != Unchanged && osMode != CurrentOSMode)
+        SetOSMode((OSMode)osMode);
+    if (layout != Unchanged || entryPointMode != Unchanged) {
+        SetConfiguration(
+            layout == Unchanged ? CurrentLayout : (KeyboardLayout)layout,
+            entryPointMode == Unchanged ? EntryPointMode : (Mode)entryPointMode);
+        CurrentProfile = NoProfile;
+        // apply a new entry point straight away when no keys are held
+        if (NumKeysOrModsPressed(InputBuffer) == 0) SetMode(EntryPointMode, Clean);
+    }
+    return CommandOk;
+}
+
+uint8_t ActivateProfileById(const uint8_t *args, uint8_t length) {
+    if (length != 1) return CommandBadLength;
+    if (!ActivateProfile(args[0])) return CommandBadArgument;
+    if (NumKeysOrModsPressed(InputBuffer) == 0) {
+        SetMode(EntryPointMode, Clean);
+    } else {
+        // run the held keys through the engine again: now hidden, they are released
+        // without tap-release keys and the new entry point takes over
+        CurrentModeState = Used;
+        uint8_t buf[8];
+        CopyBuf(InputBuffer, buf);
+        ProcessReport(buf);
+    }
+    return CommandOk;
+}
+
+uint8_t GetTaskStatsById(const uint8_t *args, uint8_t length, uint8_t *response, uint8_t *responseLength) {
+    if (length != 1) return CommandBadLength;
+    if (args[0] >= NumTasks) return CommandBadArgument;
+    TaskStats stats = GetTaskStats(args[0]);
+    response[1] = NumTaskStats();
+    PutUint32(response + 2, stats.runs);
+    PutUint32(response + 6, stats.totalMicros);
+    PutUint32(response + 10, stats.maxMicros);
+    PutUint32(response + 14, stats.lateRuns);
+    *responseLength = 18;
+    return CommandOk;
+}
+
+uint8_t GetBootStage(const uint8_t *args, uint8_t length, uint8_t *response, uint8_t *responseLength) {
+    if (length != 1) return CommandBadLength;
+    if (args[0] >= NumBootStages) return CommandBadArgument;
+    response[1] = NumBootStages;
+    PutUint32(response + 2, GetBootStageMicros(args[0]));
+    *responseLength = 6;
+    return CommandOk;
+}
+
+uint8_t UploadKeymap(const uint8_t *args, uint8_t length) {
+    if (length < 2) return CommandBadLength;
+    uint8_t first = args[0];
+    uint8_t count = args[1];
+    if (count > MaxKeySpecsPerFrame || length != 2 + count * 4) return CommandBadLength;
+    if (first + count > NumLayoutKeys) return CommandBadArgument;
+    for (uint8_t i = 0; i < count; i++) {
+        const uint8_t *spec = args + 2 + i * 4;
+        SetCustomKeySpec(first + i, (KeySpec){ spec[0], spec[1], spec[2], spec[3] });
+    }
+    return CommandOk;
+}
+
+uint8_t GetStats(const uint8_t *args, uint8_t length, uint8_t *response, uint8_t *responseLength) {
+    if (length != 2) return CommandBadLength;
+    uint8_t first = args[0];
+    uint8_t count = args[1];
+    if (first > NumStats) return CommandBadArgument;
+    if (count > MaxStatsPerFrame) count = MaxStatsPerFrame;
+    if (first + count > NumStats) count = NumStats - first;
+
+    response[1] = NumStats;
+    response[2] = first;
+    response[3] = count;
+    for (uint8_t i = 0; i < count; i++) {
+        PutUint32(response + 4 + i * 4, Stats[first + i]);
+    }
+    *responseLength = 4 + count * 4;
+    return CommandOk;
+}
+
+uint8_t GetUsage(const uint8_t *args, uint8_t length, uint8_t *response, uint8_t *responseLength) {
+    if (length != 3) return CommandBadLength;
+    uint8_t kind = args[0];
+    uint8_t first = args[1];
+    uint8_t count = args[2];
+    uint8_t total = NumUsageCounters(kind);
+    if (kind >= NumUsageKinds || first > total) return CommandBadArgument;
+    if (count > MaxUsageCountersPerFrame) count = MaxUsageCountersPerFrame;
+    if (first + count > total) count = total - first;
+
+    response[1] = kind;
+    response[2] = total;
+    response[3] = first;
+    response[4] = count;
+    for (uint8_t i = 0; i < count; i++) {
+        PutUint32(response + 5 + i * 4, GetUsageCounter(kind, first + i));
+    }
+    *responseLength = 5 + count * 4;
+    return CommandOk;
+}
+
+static_assert(MaxProgramImageChunk >= MaxFramePayload - 1, "an UploadProgramsCommand frame can hold more than a chunk");
+
+uint8_t UploadPrograms(const uint8_t *args, uint8_t length) {
+    if (length < 1) return CommandBadLength;
+    if (IsWritingKeymapPrograms()) return CommandBusy;
+    if (!WriteKeymapProgramImage(args[0], args + 1, length - 1)) return CommandBadArgument;
+    return CommandOk;
+}
+
+uint8_t Benchmark(const uint8_t *args, uint8_t length, uint8_t *response, uint8_t *responseLength) {
+    if (length != 11) return CommandBadLength;
+    uint8_t report[8];
+    for (uint8_t i = 0; i < 8; i++) report[i] = args[3 + i];
+    // an empty report would fire the key release callbacks and send output
+    if (args[0] >= NumModes || NumKeysOrModsPressed(report) == 0) return CommandBadArgument;
+    uint16_t iterations = args[1] | (args[2] << 8);
+    if (iterations > MaxBenchmarkIterations) return CommandBadArgument;
+
+    KeymapBenchmark result = BenchmarkKeymapProgram((Mode)args[0], report, iterations);
+    PutUint32(response + 1, result.nativeMicros);
+    PutUint32(response + 5, result.programMicros);
+    response[9] = result.programInstructions;
+    response[10] = result.programInstructions >> 8;
+    *responseLength = 11;
+    return CommandOk;
+}
+
+void ExecuteCommand(uint8_t type, const uint8_t *args, uint8_t length) {
+    uint8_t *response = ResponsePayload;
+    uint8_t responseLength = 1;
+    uint8_t status = CommandOk;
+
+    switch (type) {
+        case PingCommand:
+            responseLength = Ping(response);
+            break;
+        case GetConfigCommand:
+            responseLength = GetConfig(response);
+            break;
+        case SetConfigCommand:
+            status = SetConfig(args, length);
+            break;
+        case UploadKeymapCommand:
+            status = UploadKeymap(args, length);
+            break;
+        case GetStatsCommand:
+            status = GetStats(args, length, response, &responseLength);
+            break;
+        case ResetStatsCommand:
+            ResetStats();
+            ResetTaskStats();
+            break;
+        case SetTraceCommand:
+            if (length != 1) status = CommandBadLength;
+            else WriteToLog = args[0];
+            break;
+        case UploadProgramsCommand:
+            status = UploadPrograms(args, length);
+            break;
+        case CommitProgramsCommand:
+            if (IsWritingKeymapPrograms()) status = CommandBusy;
+            else if (!CommitKeymapProgramImage()) status = CommandBadArgument;
+            break;
+        case BenchmarkCommand:
+            status = Benchmark(args, length, response, &responseLength);
+            break;
+        case GetTuningCommand:
+            if (length != 1) status = CommandBadLength;
+            else if (args[0] >= NumTunings) status = CommandBadArgument;
+            else {
+                response[1] = Tunings[args[0]];
+                response[2] = Tunings[args[0]] >> 8;
+                responseLength = 3;
+            }
+            break;
+        case SetTuningCommand:
+            if (length != 3) status = CommandBadLength;
+            else if (!SetTuning(args[0], args[1] | (args[2] << 8))) status = CommandBadArgument;
+            break;
+        case GetUsageCommand:
+            status = GetUsage(args, length, response, &responseLength);
+            break;
+        case FlushUsageCommand:
+            FlushUsage();
+            break;
+        case ActivateProfileCommand:
+            status = ActivateProfileById(args, length);
+            break;
+        case GetTaskStatsCommand:
+            status = GetTaskStatsById(args, length, response, &responseLength);
+            break;
+        case SetHostLedsCommand:
+            if (length != 1) status = CommandBadLength;
+            else SetHostLeds(args[0]);
+            break;
+        case GetBootStageCommand:
+            status = GetBootStage(args, length, response, &responseLength);
+            break;
+        default:
+            status = CommandUnknown;
+    }
+
+    if (status != CommandOk) {
+        CountStat(CommandErrorsStat);
+        responseLength = 1;
+    }
+    response[0] = status;
+    WriteFrame(type | ResponseFlag, response, responseLength);
+}
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+void InitializeCommands() {
+    ResetFrameParser(CommandParser);
+}
+
+// Called from loop() between USB polls: consumes a bounded number of bytes and
+// executes at most one complete command.
+void ProcessSerialCommands() {
+    for (uint8_t n = 0; n < MaxCommandBytesPerCall && Serial.available() > 0; n++) {
+        switch (FeedFrameParser(CommandParser, Serial.read())) {
+            case FrameComplete:
+                CountStat(CommandFramesStat);
+                ExecuteCommand(CommandParser.type, FramePayload(CommandParser), CommandParser.length);
+                return;
+            case FrameCorrupt:
+                CountStat(CommandErrorsStat);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// the output path on boards without native USB, see OutputReportFrame
+void WriteOutputReportFrame(uint8_t buf[8]) {
+    uint8_t payload[9];
+    payload[0] = OutputReportSequence++;
+    for (uint8_t i = 0; i < 8; i++) payload[1 + i] = buf[i];
+    WriteFrame(OutputReportFrame, payload, sizeof(payload));
+}
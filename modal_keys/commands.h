@@ -0,0 +1,51 @@
+#if !defined(__COMMANDS_H_)
+#define __COMMANDS_H_
+
+#include <Arduino.h>
+
+#define ProtocolVersion 1
+
+// Command frame types sent by the host. Responses use the same type with
+// ResponseFlag set, and their first payload byte is a CommandStatus.
+typedef enum {
+    PingCommand = 0x01,         // -> version, number of stats, number of modes
+    GetConfigCommand,           // -> os mode, layout, entry point mode, current mode, trace, profile
+    SetConfigCommand,           // os mode, layout, entry point mode (0xFF leaves a value unchanged)
+    UploadKeymapCommand,        // first index, count, count * (shift1, key1, shift2, key2)
+    GetStatsCommand,            // first id, count -> number of stats, first id, count, count * uint32
+    ResetStatsCommand,
+    SetTraceCommand,            // 0 or 1
+    UploadProgramsCommand,      // offset, bytes of the keymap program image (see keymap_vm.h)
+    CommitProgramsCommand,      // validate and activate the uploaded image
+    BenchmarkCommand,           // mode, iterations (uint16, up to MaxBenchmarkIterations), report[8] -> native us, program us (uint32), instructions (uint16)
+    GetTuningCommand,           // id -> value (uint16)
+    SetTuningCommand,           // id, value (uint16)
+    GetUsageCommand,            // kind, first, count -> kind, number of counters, first, count, count * uint32
+    FlushUsageCommand,          // write the usage counters to EEPROM now
+    ActivateProfileCommand,     // index (see profiles.h)
+    GetTaskStatsCommand,        // id -> number of tasks (0 without TASK_STATS), runs, total us, max us, late runs (uint32 each)
+    SetHostLedsCommand,         // the host's LEDs (see leds.h), where the platform can't see its LED reports
+    GetBootStageCommand         // id -> number of stages, us since reset (uint32), 0 if not reached (see boot_timeline.h)
+} CommandId;
+
+#define ResponseFlag 0x80
+#define Unchanged 0xFF
+
+// Frames sent without a command. On boards without native USB (LEONARDO not defined) the output
+// reports go to the host this way, for linux/serial_receiver to inject. The sequence number counts
+// reports, so the receiver can tell when some were lost.
+#define OutputReportFrame 0x40      // sequence number, report[8]
+
+typedef enum {
+    CommandOk = 0,
+    CommandBadLength,
+    CommandBadArgument,
+    CommandUnknown,
+    CommandBusy                 // still writing to EEPROM what a previous command sent: send it again
+} CommandStatus;
+
+extern void InitializeCommands();
+extern void ProcessSerialCommands();
+extern void WriteOutputReportFrame(uint8_t buf[8]);
+
+#endif // __COMMANDS_H_
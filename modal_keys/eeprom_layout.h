@@ -0,0 +1,30 @@
+#if !defined(__EEPROM_LAYOUT_H_)
+#define __EEPROM_LAYOUT_H_
+
+// Map of where in EEPROM storage to store each config variable
+#define OSModeSlot 0
+#define KeyboardLayoutSlot 1
+#define CustomKeymapValidSlot 2
+
+// TuningId values (uint16_t each, up to 6)
+#define TuningsSlot 4
+
+// custom keyboard layout uploaded over the serial port (NumLayoutKeys KeySpecs)
+#define CustomKeymapSlot 16
+
+// keymap programs uploaded over the serial port (see keymap_vm.h)
+#define KeymapProgramsSlot 232
+#define KeymapProgramsSize 160
+
+// usage counters, two alternating slots (see usage.cpp)
+#define UsageSlots 392
+#define UsageSlotSize 296
+
+// dynamic macro saved with Escape+S (see macros.h): length, then the recording
+#define MacroSlot 984
+#define MacroSlotSize 40
+
+// value stored in CustomKeymapValidSlot once a custom layout has been written
+#define CustomKeymapValidMarker 0x4B
+
+#endif // __EEPROM_LAYOUT_H_
@@ -0,0 +1,500 @@
+#include "modal_keys.h"
+#include "keymap.h"
+#include "helpers.h"
+#include "abbreviations.h"
+#include "boot_timeline.h"
+#include "combos.h"
+#include "home_row.h"
+#include "leader.h"
+#include "oneshot.h"
+#include "profiles.h"
+#include "report_queue.h"
+#include "stats.h"
+#include "transform_cache.h"
+#include "typing.h"
+#include "usage.h"
+
+// The platform independent part of the pipeline: from an input report to the output reports
+// handed to SendKeysToHost, plus logging. Shared by the sketch and the Linux daemon.
+
+// budget for a passthrough report, from ProcessReport to queueing its output
+#define PassthroughTargetMicros 100
+
+// Reports received but not yet through the mode engine, e.g. while waiting for the host at startup,
+// kept as the edges from one to the next: a keystroke takes two entries of two bytes, rather than two
+// reports of eight, so the queue holds 16 keystrokes typed while the host enumerates the Arduino.
+#define InputQueueSize 32
+
+// the kind of an input edge
+#define PressEdge 0
+#define ReleaseEdge 1
+#define ModifiersEdge 2
+// on the kind of the last edge of a report
+#define LastEdgeOfReport 0x80
+
+// log text waiting to be written; the Linux daemon has room for more
+#if !defined(LogBufferSize)
+#define LogBufferSize 192
+#endif
+#define MaxLogBytesPerCall 32
+
+// ****************************************************************************
+// Type Declarations
+// ****************************************************************************
+
+struct InputEdge {
+    uint8_t kind;
+    uint8_t value;      // the key, or all the modifiers
+};
+
+// ****************************************************************************
+// Function Declarations
+// ****************************************************************************
+
+bool TransitionToState(uint8_t newbuf[8]);
+void PressShiftConflicts(uint8_t newbuf[8]);
+void PassThroughToState(uint8_t newbuf[8]);
+void SendState(uint8_t buf[8]);
+void PrintState(uint8_t inBuf[8], uint8_t outBuf[8], bool outputChanged);
+void PressKey(RichKey key);
+uint8_t QueueInputEdges(uint8_t from[8], uint8_t to[8], bool queue);
+void DequeueInputReport(uint8_t buf[8]);
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+bool WriteToLog = true;
+bool SendOutput = true;
+// PlayReport is sending: not typed by the user
+bool PlayingReport = false;
+
+uint8_t InputBuffer[8] = { 0 };
+uint8_t OutputBuffer[8] = { 0 };
+
+InputEdge InputQueue[InputQueueSize];
+uint8_t InputQueueHead = 0;
+uint8_t InputQueueCount = 0;
+// the report after the last queued edge
+uint8_t InputQueueTail[8] = { 0 };
+// a report's edges didn't fit: InputQueueTail goes through as one report after the queued ones
+bool InputQueueOverflowed = false;
+// the last report received, before combos
+uint8_t PreviousInputReport[8] = { 0 };
+
+char LogText[LogBufferSize];
+uint16_t LogTextHead = 0;
+uint16_t LogTextLength = 0;
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+// Take a report from the keyboard, for ProcessInputReports to handle outside the USB callback.
+void QueueInputReport(uint8_t buf[8]) {
+    NoteBootStage(FirstInputStage);
+    if (WaitingForHost()) CountStat(InputReportsHeldForHostStat);
+    if (!InputQueueOverflowed) {
+        uint8_t *last = InputQueueCount ? InputQueueTail : PreviousInputReport;
+        if (InputQueueCount + QueueInputEdges(last, buf, false) <= InputQueueSize) {
+            QueueInputEdges(last, buf, true);
+        } else {
+            // Full while typing is in progress or the host isn't there yet, when reports mustn't
+            // be handled. This report and the ones after it until the queue has drained become
+            // one: the edges between them are lost, but no key is left held.
+            InputQueueOverflowed = true;
+        }
+    }
+    if (InputQueueOverflowed) CountStat(InputQueueOverflowsStat);
+    CopyBuf(buf, InputQueueTail);
+}
+
+// called from loop(); waits while an item of the typing queue is being typed (see typing.h), and
+// for the host at startup
+void ProcessInputReports() {
+    while ((InputQueueCount || InputQueueOverflowed) && !TypingInProgress() && !WaitingForHost()) {
+        uint8_t buf[8];
+        if (InputQueueCount) {
+            DequeueInputReport(buf);
+        } else {
+            CopyBuf(InputQueueTail, buf);
+            InputQueueOverflowed = false;
+        }
+        ParseReport(buf, PreviousInputReport);
+    }
+}
+
+// The keyboard went away: forget the keys it held and the modes they entered, and release
+// everything on the host at once. The configuration stays as it is.
+void ResetInput() {
+    InputQueueCount = 0;
+    InputQueueOverflowed = false;
+    memset(PreviousInputReport, 0, sizeof(PreviousInputReport));
+    memset(InputBuffer, 0, sizeof(InputBuffer));
+    memset(OutputBuffer, 0, sizeof(OutputBuffer));
+    ResetCombos();
+    ResetHomeRowMods();
+    ResetOneShotModifiers();
+    if (CurrentMode != EntryPointMode) SetMode(EntryPointMode, Clean);
+    ReleaseAllKeysNow();
+}
+
+// Handle a report from the keyboard. prevbuf holds the previous report and is updated.
+void ParseReport(uint8_t buf[8], uint8_t prevbuf[8]) {
+    CountStat(InputReportsStat);
+    CountKeyPresses(buf, prevbuf);
+    CopyBuf(buf, prevbuf);
+    FilterCombos(buf);
+}
+
+// run a (filtered) input report through the mode engine and send the result
+void ProcessReport(uint8_t buf[8]) {
+    uint32_t start = micros();
+    MaskProfileHeldKeys(buf);
+    if (LeaderActive()) {
+        // the sequence goes to the leader instead, and nothing to the host
+        CopyBuf(buf, InputBuffer);
+        FeedLeader(buf);
+        uint8_t released[8] = { 0 };
+        TransitionToState(released);
+        return;
+    }
+    uint8_t oneShotMods = OneShotModifiersFor(buf, InputBuffer);
+    uint8_t seededMods = oneShotMods | HomeRowModifiers();
+    CopyBuf(buf, InputBuffer);
+
+    uint8_t outbuf[8] = { 0 };
+    if (OutputBuffer[0] == 0 && !seededMods && CanPassThrough(buf)) {
+        PassThroughBuffer(buf, outbuf);
+        PassThroughToState(outbuf);
+
+        uint32_t elapsed = micros() - start;
+        CountStat(PassthroughReportsStat);
+        Stats[PassthroughTotalMicrosStat] += elapsed;
+        if (elapsed > Stats[PassthroughMaxMicrosStat]) Stats[PassthroughMaxMicrosStat] = elapsed;
+        if (elapsed > PassthroughTargetMicros) CountStat(PassthroughOverTargetStat);
+        return;
+    }
+    if (seededMods) {
+        // as if a keymap had sent them first, so the layout maps the key with them
+        outbuf[0] = outbuf[1] = seededMods;
+        CountStat(TransformCacheUncachedStat);
+        TransformBuffer(buf, outbuf);
+    } else {
+        CachedTransformBuffer(buf, outbuf);
+    }
+    UpdateOneShotModifiers(oneShotMods, outbuf, OutputBuffer);
+    TransitionToState(outbuf);
+    ClearShiftNeeds();
+}
+
+// ****************************************************************************
+// Helper Functions
+// ****************************************************************************
+
+void QueueInputEdge(uint8_t kind, uint8_t value) {
+    InputQueue[(InputQueueHead + InputQueueCount) % InputQueueSize] = (InputEdge){ kind, value };
+    InputQueueCount++;
+}
+
+// The edges from report from to report to, queued if queue; returns how many there are. A report
+// without any still takes one, so every report goes through the mode engine as it did.
+uint8_t QueueInputEdges(uint8_t from[8], uint8_t to[8], bool queue) {
+    uint8_t count = 0;
+    for (uint8_t i = 2; i < 8; i++) {
+        if (from[i] && !IsKeyPressedInBuffer(from[i], to)) {
+            if (queue) QueueInputEdge(ReleaseEdge, from[i]);
+            count++;
+        }
+    }
+    for (uint8_t i = 2; i < 8; i++) {
+        if (to[i] && !IsKeyPressedInBuffer(to[i], from)) {
+            if (queue) QueueInputEdge(PressEdge, to[i]);
+            count++;
+        }
+    }
+    if (from[0] != to[0] || !count) {
+        if (queue) QueueInputEdge(ModifiersEdge, to[0]);
+        count++;
+    }
+    if (queue) InputQueue[(InputQueueHead + InputQueueCount - 1) % InputQueueSize].kind |= LastEdgeOfReport;
+    return count;
+}
+
+// the next queued report: PreviousInputReport with the edges up to the end of the report applied
+void DequeueInputReport(uint8_t buf[8]) {
+    CopyBuf(PreviousInputReport, buf);
+    bool last = false;
+    while (!last) {
+        InputEdge edge = InputQueue[InputQueueHead];
+        InputQueueHead = (InputQueueHead + 1) % InputQueueSize;
+        InputQueueCount--;
+        last = edge.kind & LastEdgeOfReport;
+        switch (edge.kind & ~LastEdgeOfReport) {
+            case PressEdge:
+                MergeKeyIntoBuffer((RichKey){ 0, edge.value }, buf, false);
+                break;
+            case ReleaseEdge: {
+                // the keys after it move up
+                uint8_t n = 2;
+                for (uint8_t i = 2; i < 8; i++) {
+                    if (buf[i] != edge.value) buf[n++] = buf[i];
+                }
+                while (n < 8) buf[n++] = 0;
+                break;
+            }
+            case ModifiersEdge:
+                buf[0] = edge.value;
+                break;
+        }
+    }
+}
+
+// returns true if a new state was transmitted
+bool TransitionToState(uint8_t newbuf[8]) {
+    if (EqualBuffers(newbuf, OutputBuffer)) { // no need to run transition if states are already equal
+        PrintState(InputBuffer, OutputBuffer, false);
+        return false;
+    }
+
+    uint8_t oldbuf[8] = { 0 };
+    CopyBuf(OutputBuffer, oldbuf);
+
+    // do released keys
+    uint8_t releaseKeys[8] = { 0 };
+    if (KeyIntersection(oldbuf, newbuf, releaseKeys)){
+        releaseKeys[0] = oldbuf[0];
+        SendState(releaseKeys);
+    }
+
+    // do released mods
+    uint8_t releaseMods[8] = { 0 };
+    if (ModIntersection(oldbuf, newbuf, releaseMods)){
+        CopyKeys(releaseKeys, releaseMods);
+        SendState(releaseMods);
+    }
+
+    // do pressed keys that need another shift than newbuf has
+    PressShiftConflicts(newbuf);
+
+    // do pressed mods
+    uint8_t pressMods[8] = { 0 };
+    if (newbuf[0] != OutputBuffer[0]){
+        pressMods[0] = newbuf[0];
+        CopyKeys(OutputBuffer, pressMods);
+        SendState(pressMods);
+    }
+
+    // do pressed keys
+    if (!EqualKeys(newbuf, OutputBuffer)){
+        SendState(newbuf);
+    }
+    return true;
+}
+
+// Keys pressed together whose layout mappings need different shifts (see ShiftNeededFor) can't
+// share a report. Press those that disagree with newbuf first, one shift state at a time,
+// so newbuf itself is left with the keys that agree with it.
+void PressShiftConflicts(uint8_t newbuf[8]) {
+    uint8_t newShift = newbuf[0] & (LShift | RShift);
+    bool conflict = false;
+    for (uint8_t i = 2; i < 8; i++) {
+        uint8_t shift = ShiftNeededFor(newbuf[i]);
+        if (newbuf[i] && shift != NoShiftNeed && shift != newShift && !IsKeyPressedInBuffer(newbuf[i], OutputBuffer)) {
+            conflict = true;
+            break;
+        }
+    }
+    if (!conflict) return;
+    CountStat(ShiftConflictsStat);
+
+    // starting with the shift the host has, which saves a modifier report
+    static const uint8_t Shifts[] = { 0, LShift, RShift, LShift | RShift };
+    uint8_t hostShift = OutputBuffer[0] & (LShift | RShift);
+    for (int8_t s = -1; s < 4; s++) {
+        uint8_t shift = s < 0 ? hostShift : Shifts[s];
+        if (shift == newShift || (s >= 0 && shift == hostShift)) continue;
+        uint8_t buf[8];
+        CopyBuf(OutputBuffer, buf);
+        for (uint8_t i = 2; i < 8; i++) {
+            if (newbuf[i] && ShiftNeededFor(newbuf[i]) == shift && !IsKeyPressedInBuffer(newbuf[i], OutputBuffer))
+                MergeKeyIntoBuffer((RichKey){ 0, newbuf[i] }, buf, false);
+        }
+        if (EqualKeys(buf, OutputBuffer)) continue;
+
+        // the other modifiers as newbuf has them, then the keys
+        uint8_t mods[8];
+        CopyBuf(OutputBuffer, mods);
+        mods[0] = (newbuf[0] & ~(LShift | RShift)) | shift;
+        if (mods[0] != OutputBuffer[0]) {
+            SendState(mods);
+            CountStat(ShiftConflictReportsStat);
+        }
+        buf[0] = mods[0];
+        SendState(buf);
+        CountStat(ShiftConflictReportsStat);
+    }
+}
+
+// TransitionToState for states without modifiers, without logging
+void PassThroughToState(uint8_t newbuf[8]) {
+    if (EqualBuffers(newbuf, OutputBuffer)) return;
+
+    uint8_t releaseKeys[8] = { 0 };
+    if (KeyIntersection(OutputBuffer, newbuf, releaseKeys)) {
+        CopyBuf(releaseKeys, OutputBuffer);
+        if (SendOutput) QueueReport(OutputBuffer);
+    }
+    if (!EqualKeys(newbuf, releaseKeys)) {
+        CopyBuf(newbuf, OutputBuffer);
+        if (SendOutput) QueueReport(OutputBuffer);
+    }
+}
+
+void SendState(uint8_t buf[8]) {
+    if (!PlayingReport) FeedAbbreviations(buf, OutputBuffer);
+    CopyBuf(buf, OutputBuffer);
+    PrintState(InputBuffer, OutputBuffer, true);
+    if (SendOutput){
+        QueueReport(OutputBuffer);
+    }
+}
+
+
+
+// ****************************************************************************
+// Logging
+// ****************************************************************************
+
+String KeyToHexString(uint8_t key) {
+  int num_nibbles = 2;
+  String out = "";
+  do {
+          char v = 48 + (((key >> (num_nibbles - 1) * 4)) & 0x0f);
+          if(v > 57) v += 7;
+          out += v;
+  } while(--num_nibbles);
+  return out;
+}
+
+String ModifiersToString(uint8_t mods) {
+    String str = "<" +
+    String((mods & LCtrl)  ? "C" : "-") +
+    String((mods & LShift) ? "S" : "-") +
+    String((mods & LAlt)   ? "A" : "-") +
+    String((mods & LGui)   ? "G" : "-") +
+    "." +
+    String((mods & RCtrl)  ? "C" : "-") +
+    String((mods & RShift) ? "S" : "-") +
+    String((mods & RAlt)   ? "A" : "-") +
+    String((mods & RGui)   ? "G" : "-") +
+    ">";
+    return str;
+}
+
+String KeyToString(uint8_t key) {
+    if (key) {
+        return KeyToHexString(key);
+    } else {
+        return "__";
+    }
+}
+
+/* shared */ String RichKeyToString(RichKey key) {
+    String modStr = ModifiersToString(key.mods);
+    String keyStr = KeyToString(key.key);
+    return modStr + keyStr;
+}
+
+// Lines are buffered whole, or dropped if they don't fit, and DrainLog() writes them out a
+// few bytes at a time, so a slow serial port never holds up the key path. The prefix is read
+// from flash, where F() keeps the literals out of RAM.
+void BufferLogLine(const __FlashStringHelper *prefix, const String &text) {
+    const char *flash = (const char *)prefix;
+    uint16_t prefixLength = prefix ? strlen_P(flash) : 0;
+    uint16_t length = prefixLength + text.length();
+    if (LogTextLength + length + 1 > LogBufferSize) {
+        CountStat(LogLinesDroppedStat);
+        return;
+    }
+    for (uint16_t i = 0; i <= length; i++) {
+        char c = i < prefixLength ? pgm_read_byte(flash + i) : i < length ? text[i - prefixLength] : '\n';
+        LogText[(LogTextHead + LogTextLength) % LogBufferSize] = c;
+        LogTextLength++;
+    }
+}
+
+/* shared */ void Log(String text){
+    if (!WriteToLog) return;
+    BufferLogLine(NULL, text);
+}
+
+/* shared */ void Log(const __FlashStringHelper *text){
+    if (!WriteToLog) return;
+    BufferLogLine(text, String());
+}
+
+/* shared */ void Log(const __FlashStringHelper *prefix, const String &text){
+    if (!WriteToLog) return;
+    BufferLogLine(prefix, text);
+}
+
+// called from loop()
+void DrainLog() {
+    char chunk[MaxLogBytesPerCall + 1];
+    uint8_t length = 0;
+    while (LogTextLength && length < MaxLogBytesPerCall) {
+        chunk[length++] = LogText[LogTextHead];
+        LogTextHead = (LogTextHead + 1) % LogBufferSize;
+        LogTextLength--;
+    }
+    if (!length) return;
+    chunk[length] = 0;
+    Serial.print(chunk);
+}
+
+bool LogPending() {
+    return LogTextLength != 0;
+}
+
+/* shared */ String BufferToString(uint8_t buf[8]) {
+    String out = "";
+    out += ModifiersToString(buf[0]);
+    out += ModifiersToString(buf[1]);
+    for (uint8_t i = 2; i < 8; i++) {
+        out += (" " + KeyToString(buf[i]));
+    }
+    return out;
+}
+
+void PrintState(uint8_t inBuf[8], uint8_t outBuf[8], bool outputChanged) {
+    if (!WriteToLog) return;
+    String line = GetStateString() + BufferToString(inBuf);
+    if (outputChanged){
+        line += "  ==>  ";
+        line += BufferToString(outBuf);
+    }
+    BufferLogLine(NULL, line);
+}
+
+void PressKey(RichKey key){
+    uint8_t buf[8];
+    CopyBuf(OutputBuffer, buf);
+    MergeKeyIntoBuffer(key, buf, true);
+    TransitionToState(buf);
+}
+
+/* shared */ void PressAndReleaseKey(RichKey key){
+    uint8_t current_buf[8];
+    CopyBuf(OutputBuffer, current_buf);
+
+    PressKey(key);
+    TransitionToState(current_buf);
+}
+
+// output that doesn't come from an input report, e.g. a macro being played back
+/* shared */ void PlayReport(uint8_t buf[8]) {
+    PlayingReport = true;
+    TransitionToState(buf);
+    PlayingReport = false;
+}
@@ -0,0 +1,116 @@
+#include "framing.h"
+
+uint16_t Crc16Update(uint16_t crc, uint8_t data) {
+    crc ^= (uint16_t)data << 8;
+    for (uint8_t i = 0; i < 8; i++) {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+    return crc;
+}
+
+void ResetFrameParser(FrameParser &parser) {
+    parser.state = WaitingForStart;
+    parser.numBytes = 0;
+    parser.pendingFrom = parser.pendingEnd = 0;
+}
+
+// Parse one byte, keeping those after the SOF in parser.bytes.
+FrameResult ParseFrameByte(FrameParser &parser, uint8_t data) {
+    if (parser.state == WaitingForStart) {
+        if (data == FrameStart) {
+            parser.state = WaitingForLength;
+            parser.numBytes = 0;
+        }
+        return FrameIncomplete;
+    }
+    parser.bytes[parser.numBytes++] = data;
+    switch (parser.state) {
+        case WaitingForLength:
+            if (data > MaxFramePayload) {
+                parser.state = WaitingForStart;
+                return FrameCorrupt;
+            }
+            parser.length = data;
+            parser.received = 0;
+            parser.crc = Crc16Update(0xFFFF, data);
+            parser.state = WaitingForType;
+            return FrameIncomplete;
+        case WaitingForType:
+            parser.type = data;
+            parser.crc = Crc16Update(parser.crc, data);
+            parser.state = parser.length ? ReadingPayload : WaitingForCrcLow;
+            return FrameIncomplete;
+        case ReadingPayload:
+            parser.received++;
+            parser.crc = Crc16Update(parser.crc, data);
+            if (parser.received == parser.length) parser.state = WaitingForCrcLow;
+            return FrameIncomplete;
+        case WaitingForCrcLow:
+            parser.state = WaitingForCrcHigh;
+            return FrameIncomplete;
+        case WaitingForCrcHigh:
+            parser.state = WaitingForStart;
+            if (parser.crc == (((uint16_t)data << 8) | parser.bytes[parser.numBytes - 2])) return FrameComplete;
+            return FrameCorrupt;
+        default:
+            break;
+    }
+    parser.state = WaitingForStart;
+    return FrameIncomplete;
+}
+
+// Consume one byte. Returns FrameComplete once a whole frame with a valid CRC has
+// been received; its type and payload stay valid until the next call. A corrupt frame
+// may have swallowed the SOF of a good one (a stray 0x7E, or a frame cut short), so
+// its bytes are parsed again from the next SOF among them, as the CLI's FrameReader
+// does.
+FrameResult FeedFrameParser(FrameParser &parser, uint8_t data) {
+    // the bytes still to parse are bytes[from, end); writes into parser.bytes never get
+    // ahead of from, so they can be parsed in place
+    uint8_t from = 0, end;
+    if (parser.pendingFrom != parser.pendingEnd) {
+        end = parser.pendingEnd - parser.pendingFrom;
+        memmove(parser.bytes, parser.bytes + parser.pendingFrom, end);
+    } else {
+        end = parser.state == WaitingForStart ? 0 : parser.numBytes;
+        from = end;
+    }
+    parser.bytes[end++] = data;
+    parser.pendingFrom = parser.pendingEnd = 0;
+
+    FrameResult result = FrameIncomplete;
+    while (from < end) {
+        switch (ParseFrameByte(parser, parser.bytes[from++])) {
+            case FrameComplete:
+                // the payload would be overwritten by parsing the rest now
+                parser.pendingFrom = from;
+                parser.pendingEnd = end;
+                return FrameComplete;
+            case FrameCorrupt:
+                // only the SOF is dropped: move the unparsed bytes up behind the frame's
+                // and rescan them all
+                memmove(parser.bytes + parser.numBytes, parser.bytes + from, end - from);
+                end = parser.numBytes + end - from;
+                from = 0;
+                result = FrameCorrupt;
+                break;
+            default:
+                break;
+        }
+    }
+    return result;
+}
+
+void WriteFrame(uint8_t type, const uint8_t *payload, uint8_t length) {
+    uint16_t crc = Crc16Update(0xFFFF, length);
+    crc = Crc16Update(crc, type);
+    for (uint8_t i = 0; i < length; i++) {
+        crc = Crc16Update(crc, payload[i]);
+    }
+    Serial.write(FrameStart);
+    Serial.write(length);
+    Serial.write(type);
+    Serial.write(payload, length);
+    Serial.write(crc & 0xFF);
+    Serial.write(crc >> 8);
+}
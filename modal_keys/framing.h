@@ -0,0 +1,64 @@
+#if !defined(__FRAMING_H_)
+#define __FRAMING_H_
+
+#include <Arduino.h>
+
+// Frames exchanged over the serial port:
+//
+//   SOF | LEN | TYPE | PAYLOAD[LEN] | CRC16 (low byte first)
+//
+// The CRC is CRC-16/CCITT (poly 0x1021, init 0xFFFF) over LEN, TYPE and PAYLOAD.
+// SOF never appears in the log text, so a receiver can resync by scanning for it.
+#define FrameStart 0x7E
+#define MaxFramePayload 32
+
+typedef enum {
+    WaitingForStart = 0,
+    WaitingForLength,
+    WaitingForType,
+    ReadingPayload,
+    WaitingForCrcLow,
+    WaitingForCrcHigh
+} FrameParserState;
+
+// The bytes of a frame after its SOF: LEN, TYPE, PAYLOAD and CRC16, plus one byte fed in
+// after the bytes left pending by a resync.
+#define MaxFrameBytes (MaxFramePayload + 5)
+
+struct FrameParser {
+    FrameParserState state;
+    uint8_t type;
+    uint8_t length;
+    uint8_t received;
+    uint16_t crc;
+    // the bytes consumed since the last SOF, parsed again from the next SOF among them when
+    // the frame turns out corrupt; the payload is bytes[2..]
+    uint8_t bytes[MaxFrameBytes];
+    uint8_t numBytes;
+    // bytes[pendingFrom, pendingEnd) were left unparsed by a frame that completed during a
+    // resync; they are parsed ahead of the next byte fed in
+    uint8_t pendingFrom;
+    uint8_t pendingEnd;
+};
+
+typedef enum {
+    FrameIncomplete = 0,
+    FrameComplete,
+    FrameCorrupt
+} FrameResult;
+
+extern uint16_t Crc16Update(uint16_t crc, uint8_t data);
+extern void ResetFrameParser(FrameParser &parser);
+extern FrameResult FeedFrameParser(FrameParser &parser, uint8_t data);
+
+inline const uint8_t *FramePayload(const FrameParser &parser) {
+    return parser.bytes + 2;
+}
+
+// between frames, with nothing left to parse again: a byte other than SOF is log text
+inline bool FrameParserIdle(const FrameParser &parser) {
+    return parser.state == WaitingForStart && parser.pendingFrom == parser.pendingEnd;
+}
+extern void WriteFrame(uint8_t type, const uint8_t *payload, uint8_t length);
+
+#endif // __FRAMING_H_
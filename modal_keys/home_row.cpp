@@ -0,0 +1,243 @@
+#include "modal_keys.h"
+#include "home_row.h"
+#include "keymap.h"
+#include "helpers.h"
+#include "stats.h"
+#include "tuning.h"
+
+// ****************************************************************************
+// Constants
+// ****************************************************************************
+
+struct HomeRowKey {
+    uint8_t key;
+    uint8_t mods;
+};
+
+// as in LeftModMode and RightModMode
+const HomeRowKey HomeRowKeys[] PROGMEM = {
+    { _A,           LShift },
+    { _S,           LAlt },
+    { _D,           LCtrl },
+    { _F,           LGui },
+    { _J,           RGui },
+    { _K,           RCtrl },
+    { _L,           LAlt },
+    { _Semicolon,   RShift },
+};
+
+#define NumHomeRowKeys (sizeof(HomeRowKeys) / sizeof(HomeRowKey))
+
+// bounds of the decision time, and the running average it starts from
+#define HomeRowMinDecisionMillis 60
+#define InitialTypingIntervalMillis 150
+// longer intervals are pauses, not typing speed
+#define MaxTypingIntervalMillis 500
+// a Backspace after this long is not a correction of the decision
+#define CorrectionWindowMillis 1000
+
+#define NoHomeRowKey 0xFF
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+// physical report as last received
+uint8_t HomeRowLastRawBuffer[8] = { 0 };
+// report and modifiers as last passed on to the mode engine
+uint8_t HomeRowLastFilteredBuffer[8] = { 0 };
+uint8_t HomeRowLastMods = 0;
+
+// index of the key held back until it is known whether it is a tap or a hold
+uint8_t PendingHomeRowKey = NoHomeRowKey;
+uint32_t PendingHomeRowSince = 0;
+
+// bit per index: keys acting as modifiers, and those of them a key has been pressed with
+uint8_t HoldingHomeRowKeys = 0;
+uint8_t UsedHomeRowKeys = 0;
+
+uint32_t LastKeyPressMillis = 0;
+uint16_t TypingIntervalMillis = InitialTypingIntervalMillis;
+
+// when the last held back key was decided; the next key press checks it for a correction
+uint32_t HomeRowDecidedMillis = 0;
+bool CheckHomeRowCorrection = false;
+
+// ****************************************************************************
+// Helper Functions
+// ****************************************************************************
+
+uint8_t HomeRowKeyIndex(uint8_t key) {
+    for (uint8_t i = 0; i < NumHomeRowKeys; i++) {
+        if (pgm_read_byte(&HomeRowKeys[i].key) == key) return i;
+    }
+    return NoHomeRowKey;
+}
+
+// like combos, only while typing without modifiers
+bool HomeRowModsActive(uint8_t buf[8]) {
+    if (Tunings[HomeRowHoldTuning] == 0 || buf[0]) return false;
+    switch (CurrentMode) {
+        case NormalTypingMode:
+        case ModalTypingMode:
+            return true;
+        default:
+            break;
+    }
+    return CurrentMode == EntryPointMode;
+}
+
+uint16_t DecisionMillis() {
+    uint16_t decision = 2 * TypingIntervalMillis;
+    if (decision < HomeRowMinDecisionMillis) decision = HomeRowMinDecisionMillis;
+    if (decision > Tunings[HomeRowHoldTuning]) decision = Tunings[HomeRowHoldTuning];
+    return decision;
+}
+
+// the running average moves an eighth of the way to each new interval
+void NoteKeyPress(uint32_t now) {
+    uint32_t interval = now - LastKeyPressMillis;
+    LastKeyPressMillis = now;
+    if (interval >= MaxTypingIntervalMillis) return;
+    TypingIntervalMillis += ((int16_t)interval - (int16_t)TypingIntervalMillis) / 8;
+}
+
+// The report the mode engine sees: the pending key and the keys acting as modifiers are
+// removed, keeping the order of the others. Passed on only if it or the modifiers changed.
+void PassOnHomeRow(uint8_t raw[8]) {
+    uint8_t filtered[8];
+    filtered[0] = raw[0];
+    filtered[1] = raw[1];
+    uint8_t j = 2;
+    for (uint8_t i = 2; i < 8; i++) {
+        uint8_t key = raw[i];
+        if (!key) continue;
+        uint8_t index = HomeRowKeyIndex(key);
+        if (index != NoHomeRowKey && (index == PendingHomeRowKey || (HoldingHomeRowKeys & (1 << index)))) continue;
+        filtered[j++] = key;
+    }
+    while (j < 8) filtered[j++] = 0;
+
+    uint8_t mods = HomeRowModifiers();
+    if (EqualBuffers(filtered, HomeRowLastFilteredBuffer) && mods == HomeRowLastMods) return;
+    CopyBuf(filtered, HomeRowLastFilteredBuffer);
+    HomeRowLastMods = mods;
+    ProcessReport(filtered);
+}
+
+void NoteHomeRowDecision(uint32_t now) {
+    uint32_t latency = now - PendingHomeRowSince;
+    Stats[HomeRowDecisionTotalMillisStat] += latency;
+    if (latency > Stats[HomeRowDecisionMaxMillisStat]) Stats[HomeRowDecisionMaxMillisStat] = latency;
+    PendingHomeRowKey = NoHomeRowKey;
+    HomeRowDecidedMillis = now;
+    CheckHomeRowCorrection = true;
+}
+
+// the pending key was typed: the mode engine sees it as it was pressed, before whatever
+// ended the wait
+void DecideHomeRowTap(uint32_t now) {
+    CountStat(HomeRowTapsStat);
+    NoteHomeRowDecision(now);
+    PassOnHomeRow(HomeRowLastRawBuffer);
+}
+
+void DecideHomeRowHold(uint32_t now) {
+    CountStat(HomeRowHoldsStat);
+    HoldingHomeRowKeys |= 1 << PendingHomeRowKey;
+    NoteHomeRowDecision(now);
+}
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+// Sits between FilterCombos and the mode engine. Other keys, and home-row keys typed in a burst,
+// go through straight away; a home-row key that starts one is held back until it is decided.
+void FilterHomeRowMods(uint8_t buf[8]) {
+    uint32_t now = millis();
+
+    // keys released: a pending key was tapped, a held one stops modifying
+    for (uint8_t i = 2; i < 8; i++) {
+        uint8_t key = HomeRowLastRawBuffer[i];
+        if (!key || IsKeyPressedInBuffer(key, buf)) continue;
+        uint8_t index = HomeRowKeyIndex(key);
+        if (index == NoHomeRowKey) continue;
+        if (index == PendingHomeRowKey) {
+            DecideHomeRowTap(now);
+        } else if (HoldingHomeRowKeys & (1 << index)) {
+            if (!(UsedHomeRowKeys & (1 << index))) CountStat(HomeRowUnusedHoldsStat);
+            HoldingHomeRowKeys &= ~(1 << index);
+            UsedHomeRowKeys &= ~(1 << index);
+        }
+    }
+
+    // keys pressed: a pending key is decided by the next key, home-row keys may start a wait
+    bool active = HomeRowModsActive(buf);
+    uint16_t decision = DecisionMillis();
+    for (uint8_t i = 2; i < 8; i++) {
+        uint8_t key = buf[i];
+        if (!key || IsKeyPressedInBuffer(key, HomeRowLastRawBuffer)) continue;
+
+        if (CheckHomeRowCorrection) {
+            CheckHomeRowCorrection = false;
+            if (key == _Backspace && now - HomeRowDecidedMillis < CorrectionWindowMillis)
+                CountStat(HomeRowCorrectionsStat);
+        }
+        bool burst = now - LastKeyPressMillis < decision;
+        NoteKeyPress(now);
+
+        if (PendingHomeRowKey != NoHomeRowKey) {
+            // held long enough to be meant as a modifier, or rolling over into the next key
+            if (now - PendingHomeRowSince >= decision) DecideHomeRowHold(now);
+            else DecideHomeRowTap(now);
+        }
+        UsedHomeRowKeys = HoldingHomeRowKeys;
+
+        uint8_t index = HomeRowKeyIndex(key);
+        if (!active || index == NoHomeRowKey) continue;
+        if (burst) {
+            CountStat(HomeRowBurstTapsStat);
+        } else {
+            PendingHomeRowKey = index;
+            PendingHomeRowSince = now;
+        }
+    }
+    if (!active && PendingHomeRowKey != NoHomeRowKey) DecideHomeRowTap(now);
+
+    CopyBuf(buf, HomeRowLastRawBuffer);
+    PassOnHomeRow(buf);
+}
+
+// the modifiers of the home-row keys held as modifiers
+uint8_t HomeRowModifiers() {
+    uint8_t mods = 0;
+    for (uint8_t i = 0; i < NumHomeRowKeys; i++) {
+        if (HoldingHomeRowKeys & (1 << i)) mods |= pgm_read_byte(&HomeRowKeys[i].mods);
+    }
+    return mods;
+}
+
+// Called from loop(): a key held on its own for HomeRowHoldTuning becomes a modifier.
+void HomeRowTask() {
+    if (PendingHomeRowKey == NoHomeRowKey) return;
+    uint32_t now = millis();
+    if (now - PendingHomeRowSince < Tunings[HomeRowHoldTuning]) return;
+    DecideHomeRowHold(now);
+    PassOnHomeRow(HomeRowLastRawBuffer);
+}
+
+// true while a home-row key is held back
+bool HomeRowPending() {
+    return PendingHomeRowKey != NoHomeRowKey;
+}
+
+void ResetHomeRowMods() {
+    memset(HomeRowLastRawBuffer, 0, sizeof(HomeRowLastRawBuffer));
+    memset(HomeRowLastFilteredBuffer, 0, sizeof(HomeRowLastFilteredBuffer));
+    HomeRowLastMods = 0;
+    PendingHomeRowKey = NoHomeRowKey;
+    HoldingHomeRowKeys = 0;
+    UsedHomeRowKeys = 0;
+    CheckHomeRowCorrection = false;
+}
@@ -0,0 +1,26 @@
+#if !defined(__HOME_ROW_H_)
+#define __HOME_ROW_H_
+
+#include <Arduino.h>
+
+// Home-row modifiers: A/S/D/F and J/K/L/; type as usual when tapped, and act as the modifiers
+// LeftMod and RightMod give them (Shift, Alt, Ctrl, Gui) when held while another key is pressed.
+// Sits between the combos and the mode engine, and only applies where combos do.
+//
+// Telling the two apart adapts to the typing speed, a running average of the time between
+// key presses (pauses left out):
+//  - a home-row key pressed within the decision time of the previous key is part of a burst
+//    of typing and goes through straight away
+//  - otherwise it is held back until it is released (a tap), another key is pressed (a hold
+//    if it has been down for the decision time, a tap rolling over into the next key if not),
+//    or HomeRowHoldTuning passes (a hold)
+// The decision time is twice the average interval, within HomeRowMinDecisionMillis and
+// HomeRowHoldTuning. Backspace as the next key after a decision counts as a misfire in the stats.
+
+extern void FilterHomeRowMods(uint8_t buf[8]);
+extern uint8_t HomeRowModifiers();
+extern void HomeRowTask();
+extern bool HomeRowPending();
+extern void ResetHomeRowMods();
+
+#endif // __HOME_ROW_H_
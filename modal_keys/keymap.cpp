@@ -5,78 +5,28 @@
 #include "layout_qwerty.h"
 #include "layout_dvorak.h"
 // #include "layout_dvorak_programmer.h"
+#include "eeprom_layout.h"
+#include "keymap_vm.h"
+#include "layers.h"
+#include "leader.h"
+#include "oneshot.h"
+#include "profiles.h"
+#include "tuning.h"
+#include "usage.h"
+#include "transform_cache.h"
+#include "typing.h"
 
 #include <EEPROM.h>
 
-// Map of where in EEPROM storage to store each config variable
-#define OSModeSlot 0
-#define KeyboardLayoutSlot 1
-
 // ****************************************************************************
 // Type Declarations
 // ****************************************************************************
 
-// Operating System Modes
-typedef enum {
-    Windows = 0,
-    OSX
-} OSMode;
-
-// Keyboard Layouts
-typedef enum {
-    qwerty = 0,
-    dvorak,
-    // dvorakProgrammer
-} KeyboardLayout;
-
-// the available keyboard modes
-typedef enum
-{
-    NormalNoKeysMode = 0,
-    ModalNoKeysMode,
-    EscapeMode,
-    CapsLockMode,
-    RightCtrlMode,
-    NormalTypingMode,
-    ModalTypingMode,
-    LeftAltMode,
-    LeftModMode,
-    RightAltMode,
-    RightModMode,
-    AltTabMode,
-    WindowSnapMode,
-    NumPadMode,
-    GamingNoKeysMode,
-    GamingBacktickMode,
-    GamingTabMode,
-    GamingCapsLockMode,
-    GamingShiftMode,
-    GamingCtrlMode,
-    GamingAltMode,
-    GamingSpaceMode,
-    BlackDesertNoKeysMode,
-    BlackDesertCapsLockMode,
-    BlackDesertSpaceMode,
-    BlackDesertAltMode
-} Mode;
-
 typedef enum {
     Left = 0,
     Right
 } Side;
 
-typedef enum {
-    Clean = 0,
-    Used
-} ModeState;
-
-// specifies action to perform after returning from a call to a KeyMapFunc function with a specific key
-typedef enum {
-    Continue = 0,
-    Stop,
-    Restart
-} ControlCode;
-
 // typedef for functions that specify a key mapping
 typedef ControlCode(*KeyMapFunc)(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]);
 
@@ -86,19 +36,16 @@ typedef ControlCode(*KeyMapFunc)(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8])
 
 // helpers
 void LoadOSMode();
+void SelectPolicies();
+void LoadCustomKeymap();
 ControlCode ChangeOSMode(OSMode osMode);
-void SetMode(Mode mode, ModeState modeState);
-ControlCode EnterMode(Mode mode, ModeState modeState);
-ControlCode ChangeConfiguration(KeyboardLayout layout, Mode entryPointMode);
-ControlCode SendKey(uint8_t keycode, uint8_t outbuf[8]);
-ControlCode SendModifiers(uint8_t mods, uint8_t outbuf[8]);
+ControlCode ChangeProfile(uint8_t index);
 ControlCode UnsetModifiers(uint8_t mods, uint8_t outbuf[8]);
-ControlCode SendKeyCombo(uint8_t mods, uint8_t keycode, uint8_t outbuf[8]);
-ControlCode SendOnlyKey(uint8_t keycode, uint8_t outbuf[8]);
 ControlCode SendOnlyKeyCombo(uint8_t mods, uint8_t keycode, uint8_t outbuf[8]);
 ControlCode SendRichKey(RichKey key, uint8_t outbuf[8]);
-ControlCode InvalidKey();
 ControlCode MapKey(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]);
+ControlCode MapModeKey(Mode mode, uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]);
+ControlCode EnterTypingLayer(Mode mode);
 uint8_t NumKeysPressed(uint8_t buf[8]);
 uint8_t NumModsPressed(uint8_t buf[8]);
 uint8_t NumKeysOrModsPressed(uint8_t buf[8]);
@@ -138,8 +85,11 @@ ControlCode BlackDesertCapsLock_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outb
 ControlCode BlackDesertSpace_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]);
 ControlCode BlackDesertAlt_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]);
 
+ControlCode Custom_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]);
+
 // state handling callbacks
 void HandleLastKeyReleased();
+void TapRelease(RichKey key);
 
 // ****************************************************************************
 // Constantseeeeeeeeee
@@ -148,13 +98,8 @@ void HandleLastKeyReleased();
 const RichKey NoKey = { 0, 0, 0 };
 const RichKey CustomModifierKey = { 0, 0, _CustomModifier };
 
-// Keymaps
-const KeySpec *Keymap[] =
-{
-    qwertyKeymap,
-    dvorakKeymap,
-    // dvorakProgrammerKeymap
-};
+// custom layout, uploaded over the serial port and persisted in EEPROM
+KeySpec customKeymap[NumLayoutKeys];
 
 // array of KeyMapFuncs, one for each mode
 const KeyMapFunc KeyMaps[] = {
@@ -183,7 +128,11 @@ const KeyMapFunc KeyMaps[] = {
     &BlackDesertEntryPoint_keymap,  /* BlackDesertNoKeysMode */
     &BlackDesertCapsLock_keymap,    /* BlackDesertCapsLockMode */
     &BlackDesertSpace_keymap,       /* BlackDesertSpaceMode */
-    &BlackDesertAlt_keymap          /* BlackDesertAltMode */
+    &BlackDesertAlt_keymap,         /* BlackDesertAltMode */
+    &Custom_keymap,                 /* CustomMode1 */
+    &Custom_keymap,                 /* CustomMode2 */
+    &Custom_keymap,                 /* CustomMode3 */
+    &Custom_keymap                  /* CustomMode4 */
 };
 
 // ****************************************************************************
@@ -195,45 +144,123 @@ Mode EntryPointMode = ModalNoKeysMode;
 Mode CurrentMode = ModalNoKeysMode;
 OSMode CurrentOSMode = Windows;
 ModeState CurrentModeState = Clean;
+// the mode whose keymap is running, CurrentMode or one below it
+Mode MappedMode = ModalNoKeysMode;
+bool MappingOnly = false;
+// the top layer's keymap has run for the report being transformed, so its exit condition has
+// been checked
+bool TopLayerMapped = false;
+
+// custom layout entries not yet written to EEPROM, a bit each, and the byte of the entry
+// CustomKeymapTask is writing
+uint8_t CustomKeymapUnsaved[(NumLayoutKeys + 7) / 8] = { 0 };
+bool SavingCustomKeymap = false;
+// the valid marker has been cleared for the save in progress
+bool CustomKeymapMarkerCleared = false;
+uint8_t CustomKeymapSaveEntry = 0;
+uint8_t CustomKeymapSaveByte = 0;
+
+// ****************************************************************************
+// OS and Layout Policies
+// ****************************************************************************
+
+// modifiers that differ between operating systems. The policies are extern so they can be
+// template arguments.
+struct OSPolicy {
+    uint8_t capsLockMods;
+    uint8_t lCtrlMods;
+    uint8_t appSwitchMods[2];   // by Side
+    uint8_t windowSnapMods;
+};
+
+extern const OSPolicy WindowsPolicy = { LCtrl, LCtrl, { LAlt, RAlt }, LCtrl | LGui };
+extern const OSPolicy OSXPolicy = { LGui, LCtrl, { LGui, RGui }, LCtrl | LGui | LShift };
+
+// CurrentLayout resolved by SelectPolicies(): the key combo to send for each key from _A up to
+// (not including) _CapsLock, without and with shift
+struct ResolvedKey {
+    uint8_t mods;
+    uint8_t key;
+};
+ResolvedKey ResolvedLayout[2][NumLayoutKeys - 1];
+
+// the shift each layout key of the report being transformed needs. The last key decides the
+// shift of outbuf, so when they disagree TransitionToState presses the others separately.
+uint8_t ShiftNeedKeys[6];
+uint8_t ShiftNeedMods[6];
+uint8_t NumShiftNeeds = 0;
+bool ShiftConflict = false;
+
+void NoteShiftNeed(uint8_t key, uint8_t shift) {
+    if (NumShiftNeeds == sizeof(ShiftNeedKeys)) return;
+    if (NumShiftNeeds && shift != ShiftNeedMods[0] && !ShiftConflict) {
+        ShiftConflict = true;
+        // the resolution isn't part of outbuf
+        NoteTransformSideEffect();
+    }
+    ShiftNeedKeys[NumShiftNeeds] = key;
+    ShiftNeedMods[NumShiftNeeds] = shift;
+    NumShiftNeeds++;
+}
+
+// mapNormalKeyToCurrentLayout, specialized for one OS at compile time
+template <const OSPolicy &OS>
+ControlCode MapKeyToLayout(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]) {
+    // map modifiers
+    if (i == 0) {
+        if (inbuf[0] & LCtrl) SendRichKey((RichKey){ OS.lCtrlMods, 0 }, outbuf); //map LCtrl to OS-specific key
+        return SendModifiers(inbuf[0] & ~LCtrl, outbuf);
+    }
+    // map key
+    uint8_t inkey = inbuf[i];
+    // lookup key for the keyboard layout
+    if (inkey >= _A && inkey < _CapsLock){
+        ResolvedKey mapped = ResolvedLayout[(outbuf[1] & (LShift | RShift)) != 0][inkey - _A];
+        UnsetModifiers(LShift | RShift, outbuf);
+        NoteShiftNeed(mapped.key, mapped.mods & (LShift | RShift));
+        return SendKeyCombo(mapped.mods, mapped.key, outbuf);
+    }
+    if (inkey == _CapsLock) return SendRichKey((RichKey){ OS.capsLockMods, 0 }, outbuf);
+
+    return SendKey(inkey, outbuf);
+}
+
+// by OSMode
+const OSPolicy *const OSPolicies[NumOSModes] = { &WindowsPolicy, &OSXPolicy };
+const KeyMapFunc LayoutMaps[NumOSModes] = { &MapKeyToLayout<WindowsPolicy>, &MapKeyToLayout<OSXPolicy> };
+
+// by KeyboardLayout
+const KeySpec *const Layouts[NumKeyboardLayouts] = {
+    qwertyKeymap,
+    dvorakKeymap,
+    // dvorakProgrammerKeymap,
+    customKeymap
+};
+
+// the specialization for CurrentOSMode, swapped by SelectPolicies()
+const OSPolicy *CurrentOSPolicy = &WindowsPolicy;
+KeyMapFunc CurrentLayoutMap = &MapKeyToLayout<WindowsPolicy>;
+// CurrentLayout maps every unshifted key to itself, so reports can pass through unchanged
+bool CurrentLayoutIsIdentity = false;
 
 // ****************************************************************************
 // State Dependant Values
 // ****************************************************************************
 
 RichKey CapsLockMod() {
-    switch(CurrentOSMode){
-        case Windows: return (RichKey){ LCtrl, 0 };
-        case OSX: return (RichKey) { LGui, 0 };
-    }
+    return (RichKey){ CurrentOSPolicy->capsLockMods, 0 };
 }
 
 RichKey LCtrlMod() {
-    switch(CurrentOSMode){
-        case Windows: return (RichKey) { LCtrl, 0 };
-        case OSX: return (RichKey) { LCtrl, 0 };
-    }
+    return (RichKey){ CurrentOSPolicy->lCtrlMods, 0 };
 }
 
 uint8_t AppSwitchModifierKeycode(Side side) {
-    switch (side) {
-        case Left:
-            switch (CurrentOSMode){
-                case Windows: return LAlt;
-                case OSX: return LGui;
-            }
-        case Right:
-            switch (CurrentOSMode){
-                case Windows: return RAlt;
-                case OSX: return RGui;
-            }
-    }
+    return CurrentOSPolicy->appSwitchMods[side];
 }
 
 uint8_t WindowSnapModifierKeycode() {
-    switch(CurrentOSMode){
-        case Windows: return LCtrl | LGui;
-        case OSX: return LCtrl | LGui | LShift;
-    }
+    return CurrentOSPolicy->windowSnapMods;
 }
 
 // ****************************************************************************
@@ -254,11 +281,13 @@ ControlCode Escape_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]) {
      // map subsequent keys
     if (i >= 2) switch (inbuf[i]) {
         case _Escape:    return Continue;
-        case _F1:        return ChangeConfiguration(qwerty, NormalNoKeysMode);
-        case _F2:        return ChangeConfiguration(dvorak, ModalNoKeysMode);
-        case _F3:        return ChangeConfiguration(qwerty, GamingNoKeysMode);
-        case _F4:        return ChangeConfiguration(qwerty, BlackDesertNoKeysMode);
+        case _Space:     return StartLeaderSequence();
+        case _R:         return MacroKey(RecordMacroCommand, inbuf[i]);
+        case _P:         return MacroKey(PlayMacroCommand, inbuf[i]);
+        case _S:         return MacroKey(SaveMacroCommand, inbuf[i]);
     }
+    if (i >= 2 && inbuf[i] >= _F1 && inbuf[i] < _F1 + NumProfiles())
+        return ChangeProfile(inbuf[i] - _F1);
     // all other keys
     return InvalidKey();
 }
@@ -287,12 +316,8 @@ ControlCode RightCtrl_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]) {
     }
 
      // map first key
-    if (i == 2) switch (inbuf[i]) {
-        case _1:        return ChangeConfiguration(qwerty, NormalNoKeysMode);
-        case _2:        return ChangeConfiguration(dvorak, ModalNoKeysMode);
-        case _3:        return ChangeConfiguration(qwerty, GamingNoKeysMode);
-        case _4:        return ChangeConfiguration(qwerty, BlackDesertNoKeysMode);
-    }
+    if (i == 2 && inbuf[i] >= _1 && inbuf[i] < _1 + NumProfiles())
+        return ChangeProfile(inbuf[i] - _1);
     // all other keys
     return EnterMode(NormalTypingMode, Used);
 }
@@ -331,29 +356,7 @@ ControlCode ModalEntryPoint_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8
 }
 
 ControlCode mapNormalKeyToCurrentLayout(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]) {
-    // map modifiers
-    if (i == 0) {
-        if (inbuf[0] & LCtrl) SendRichKey(LCtrlMod(), outbuf); //map LCtrl to OS-specific key
-        return SendModifiers(inbuf[0] & ~LCtrl, outbuf);
-    }
-    // map key
-    if (i >= 2) {
-        uint8_t inkey = inbuf[i];
-        switch (inkey){
-            case _CapsLock:         return SendRichKey(CapsLockMod(), outbuf);
-        }
-        // lookup key for current keyboard layout
-        if (inkey >= _A && inkey <= _CapsLock){
-            uint8_t shiftOn = outbuf[1] & (LShift | RShift);
-            UnsetModifiers(LShift | RShift, outbuf);
-            KeySpec keySpec = Keymap[CurrentLayout][inkey - _A];
-            uint8_t mappedShift = shiftOn ? keySpec.shift2 : keySpec.shift1;
-            uint8_t mappedKey = shiftOn ? keySpec.key2 : keySpec.key1;
-            return SendKeyCombo(mappedShift, mappedKey, outbuf);
-        }
-
-        return SendKey(inkey, outbuf);
-    }
+    return CurrentLayoutMap(inbuf, i, outbuf);
 }
 
 // the keymap that just maps the key to the current keyboard layout
@@ -380,20 +383,20 @@ ControlCode LeftAltMode_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]) {
     if (i == 2) switch (inbuf[i]) {
         // map secondary modifier
         case _X:             return EnterMode(NumPadMode, Used);
-        case _C:             return EnterMode(WindowSnapMode, Used);
+        case _C:             return EnterTypingLayer(WindowSnapMode);
     }
     // map any key
     if (i >= 2) switch (inbuf[i]) {
-        // alt mode modifiers
-        case _Q:             return SendModifiers(LShift, outbuf);
-        case _W:             return SendModifiers(LAlt, outbuf);
-        case _E:             return SendModifiers(LCtrl, outbuf);
-        case _R:             return SendModifiers(LGui, outbuf);
+        // alt mode modifiers, one-shot when tapped
+        case _Q:             return SendOneShotModifiers(LShift, outbuf);
+        case _W:             return SendOneShotModifiers(LAlt, outbuf);
+        case _E:             return SendOneShotModifiers(LCtrl, outbuf);
+        case _R:             return SendOneShotModifiers(LGui, outbuf);
         // normalTypingMode mode modifiers
-        case _A:             return EnterMode(LeftModMode, Used);
-        case _S:             return EnterMode(LeftModMode, Used);
-        case _D:             return EnterMode(LeftModMode, Used);
-        case _F:             return EnterMode(LeftModMode, Used);
+        case _A:             return EnterTypingLayer(LeftModMode);
+        case _S:             return EnterTypingLayer(LeftModMode);
+        case _D:             return EnterTypingLayer(LeftModMode);
+        case _F:             return EnterTypingLayer(LeftModMode);
 
         // Left Hand keys
         case _Backtick:      return EnterMode(AltTabMode, Used);
@@ -458,8 +461,8 @@ ControlCode LeftModMode_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]) {
         case _LeftBracket:   return SendKey(_ForwardSlash, outbuf);
         case _RightBracket:  return SendKey(_Equals, outbuf);
     }
-    // all other keys
-    return mapNormalKeyToCurrentLayout(inbuf, i, outbuf);
+    // all other keys: the layer below
+    return FallThrough;
 }
 
 ControlCode RightAltMode_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]) {
@@ -469,16 +472,16 @@ ControlCode RightAltMode_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8])
     }
     // map key
     if (i >= 2) switch (inbuf[i]) {
-         // alt mode modifiers
-        case _U:             return SendModifiers(RGui, outbuf);
-        case _I:             return SendModifiers(RCtrl, outbuf);
-        case _O:             return SendModifiers(LAlt, outbuf); // RAlt is treated as Alt Grave and doesn't work as Meta key sometimes on Linux
-        case _P:             return SendModifiers(RShift, outbuf);
+         // alt mode modifiers, one-shot when tapped
+        case _U:             return SendOneShotModifiers(RGui, outbuf);
+        case _I:             return SendOneShotModifiers(RCtrl, outbuf);
+        case _O:             return SendOneShotModifiers(LAlt, outbuf); // RAlt is treated as Alt Grave and doesn't work as Meta key sometimes on Linux
+        case _P:             return SendOneShotModifiers(RShift, outbuf);
         // normalTypingMode mode modifiers
-        case _J:             return EnterMode(RightModMode, Used);
-        case _K:             return EnterMode(RightModMode, Used);
-        case _L:             return EnterMode(RightModMode, Used);
-        case _Semicolon:     return EnterMode(RightModMode, Used);
+        case _J:             return EnterTypingLayer(RightModMode);
+        case _K:             return EnterTypingLayer(RightModMode);
+        case _L:             return EnterTypingLayer(RightModMode);
+        case _Semicolon:     return EnterTypingLayer(RightModMode);
         // Left Hand keys
         case _Tab:           return EnterMode(AltTabMode, Used);
         case _1:             return SendKey(_F1, outbuf);
@@ -510,6 +513,12 @@ ControlCode RightAltMode_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8])
         case _Enter:         return SendKey(_Enter, outbuf);
         case _Fullstop:      return SendKey(_Fullstop, outbuf);
         case _Comma:         return SendKey(_Comma, outbuf);
+        // characters without keys
+        case _Dash:          return SendUnicode(0x2014, inbuf[i]);     // em dash
+        case _Equals:        return SendUnicode(0x2260, inbuf[i]);     // not equal to
+        case _LeftBracket:   return SendUnicode(0x2190, inbuf[i]);     // left arrow
+        case _RightBracket:  return SendUnicode(0x2192, inbuf[i]);     // right arrow
+        case _Apostrophe:    return SendUnicode(0x2026, inbuf[i]);     // ellipsis
 
         // Right Hand keys
         case _Backslash:     return EnterMode(AltTabMode, Used);
@@ -543,8 +552,8 @@ ControlCode RightModMode_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8])
         case _5:             return SendKey(_5, outbuf);
         case _6:             return SendKey(_6, outbuf);
     }
-    // all other keys
-    return mapNormalKeyToCurrentLayout(inbuf, i, outbuf);
+    // all other keys: the layer below
+    return FallThrough;
 }
 
 ControlCode AltTab_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]) {
@@ -596,8 +605,8 @@ ControlCode WindowSnap_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]) {
     if (i == 2) switch (inbuf[i]) { // must be _C because of exit guard
         default:           return SendModifiers(WindowSnapModifierKeycode(), outbuf);
     }
-    // all other keys
-    return mapNormalKeyToCurrentLayout(inbuf, i, outbuf);
+    // all other keys: the layer below
+    return FallThrough;
 }
 
 ControlCode NumPad_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]) {
@@ -812,6 +821,8 @@ ControlCode GamingCtrl_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]) {
         uint8_t key = inbuf[i];
         return SendKeyCombo(mods, key, outbuf);
     }
+    // TransformBuffer never maps index 1
+    return Continue;
 }
 
 ControlCode GamingAlt_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]) {
@@ -1017,6 +1028,14 @@ ControlCode BlackDesertAlt_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]
     return EnterMode(NormalTypingMode, Used);
 }
 
+// ================== Custom Modes ===================
+
+// Custom modes get their behavior from keymap programs uploaded into EEPROM (see keymap_vm.h).
+// Keys not handled by the program end up here and are typed normally.
+ControlCode Custom_keymap(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]) {
+    return mapNormalKeyToCurrentLayout(inbuf, i, outbuf);
+}
+
 // ****************************************************************************
 // State Handling Callbacks
 // ****************************************************************************
@@ -1025,40 +1044,42 @@ void HandleLastKeyReleased() {
     // send normalTypingMode keys on release of custom modifier if no other keys were pressed while it was held down
     if (CurrentModeState == Clean) switch (CurrentMode) {
         case EscapeMode: // send Escape on release
-            PressAndReleaseKey((RichKey){ 0, _Escape } );
+            TapRelease((RichKey){ 0, _Escape } );
             break;
         case CapsLockMode: // send Escape on release
-            PressAndReleaseKey((RichKey){ 0, _Escape } );
+            TapRelease((RichKey){ 0, _Escape } );
             break;
         case RightCtrlMode: // send RCtrl on releasecase RightCtrlMode: // send RCtrl on release
-            PressAndReleaseKey((RichKey){ RCtrl, 0 } );
+            TapRelease((RichKey){ RCtrl, 0 } );
             break;
         case LeftAltMode: // send Left Alt on release
-            PressAndReleaseKey((RichKey){ LAlt, 0 } );
+            TapRelease((RichKey){ LAlt, 0 } );
             break;
         case RightAltMode: // send Right Alt on release
-            PressAndReleaseKey((RichKey){ RAlt, 0 } );
+            TapRelease((RichKey){ RAlt, 0 } );
             break;
         case GamingBacktickMode: // send Backtick on release
-            PressAndReleaseKey((RichKey){ 0, _Backtick } );
+            TapRelease((RichKey){ 0, _Backtick } );
             break;
         case GamingTabMode: // send Tab on release
-            PressAndReleaseKey((RichKey){ 0, _Tab } );
+            TapRelease((RichKey){ 0, _Tab } );
             break;
         case GamingCtrlMode: // send Escape on release
-            PressAndReleaseKey((RichKey){ 0, _Escape } );
+            TapRelease((RichKey){ 0, _Escape } );
             break;
         case GamingAltMode: // send LAlt on release
-            PressAndReleaseKey((RichKey){ LAlt, 0 } );
+            TapRelease((RichKey){ LAlt, 0 } );
             break;
         case GamingSpaceMode: // send Space on release
-            PressAndReleaseKey((RichKey){ 0, _Space } );
+            TapRelease((RichKey){ 0, _Space } );
             break;
         case BlackDesertCapsLockMode: // send Ctrl on release
-            PressAndReleaseKey((RichKey){ LCtrl, 0 } );
+            TapRelease((RichKey){ LCtrl, 0 } );
             break;
         case BlackDesertSpaceMode: // send Space on release
-            PressAndReleaseKey((RichKey){ 0, _Space } );
+            TapRelease((RichKey){ 0, _Space } );
+            break;
+        default:
             break;
     }
     SetMode(EntryPointMode, Clean);
@@ -1068,39 +1089,158 @@ void HandleLastKeyReleased() {
 // Helper Functions
 // ****************************************************************************
 
+// send the key a custom modifier stands for when it was tapped on its own
+void TapRelease(RichKey key) {
+    CountUsageEvent(TapReleaseUsage);
+    PressAndReleaseKey(key);
+}
+
 void LoadOSMode() {
-    OSMode osMode = Windows;
-    EEPROM.get( OSModeSlot, osMode );
+    // a byte, whatever size the compiler gives the enum
+    uint8_t osMode = EEPROM.read( OSModeSlot );
+    // erased EEPROM
+    CurrentOSMode = osMode < NumOSModes ? (OSMode)osMode : Windows;
+    SelectPolicies();
+}
+
+// point the dispatch at the specialization for the current OS and resolve the current layout
+void SelectPolicies() {
+    CurrentOSPolicy = OSPolicies[CurrentOSMode];
+    CurrentLayoutMap = LayoutMaps[CurrentOSMode];
+
+    // CapsLock is never looked up in the layout
+    const KeySpec *layout = Layouts[CurrentLayout];
+    CurrentLayoutIsIdentity = true;
+    for (uint8_t i = 0; i < NumLayoutKeys - 1; i++) {
+        ResolvedLayout[0][i] = (ResolvedKey){ layout[i].shift1, layout[i].key1 };
+        ResolvedLayout[1][i] = (ResolvedKey){ layout[i].shift2, layout[i].key2 };
+        if (layout[i].shift1 != 0 || layout[i].key1 != _A + i) CurrentLayoutIsIdentity = false;
+    }
+}
+
+// the custom layout starts out as a copy of qwerty until one is uploaded
+void LoadCustomKeymap() {
+    bool valid = EEPROM.read(CustomKeymapValidSlot) == CustomKeymapValidMarker;
+    for (uint8_t i = 0; i < NumLayoutKeys; i++) {
+        if (valid)
+            EEPROM.get( CustomKeymapSlot + i * sizeof(KeySpec), customKeymap[i] );
+        else
+            customKeymap[i] = qwertyKeymap[i];
+    }
+}
+
+void SetOSMode(OSMode osMode) {
     CurrentOSMode = osMode;
+    SelectPolicies();
+    InvalidateTransformCache();
+    EEPROM.update( OSModeSlot, (uint8_t)osMode );
+    Log(F("new OSMode: "), GetOSModeString(osMode));
 }
 
 ControlCode ChangeOSMode(OSMode osMode) {
+    NoteTransformSideEffect();
     CurrentModeState = Used;
-    CurrentOSMode = osMode;
-    EEPROM.put( OSModeSlot, osMode );
-    Log("new OSMode: " + GetOSModeString(osMode));
+    if (!MappingOnly) SetOSMode(osMode);
     return Stop;
 }
 
 void SetMode(Mode mode, ModeState modeState) {
-    Log("set Mode: " + GetModeString(mode));
+    ClearLayers();
+    CountModeTime(CurrentMode);
+    Log(F("set Mode: "), GetModeString(mode));
     CurrentMode = mode;
     CurrentModeState = modeState;
 }
 
 ControlCode EnterMode(Mode mode, ModeState modeState) {
+    CountUsageEvent(EnterModeUsage);
     SetMode(mode, modeState);
     return Restart;
 }
 
-ControlCode ChangeConfiguration(KeyboardLayout layout, Mode entryPointMode) {
-    CurrentModeState = Used;
+// put mode on top of the current mode, which keeps the keys mode falls through for
+ControlCode PushLayer(Mode mode, ModeState modeState) {
+    // the stack isn't part of the transform cache's key
+    NoteTransformSideEffect();
+    if (!PushLowerLayer(CurrentMode)) return EnterMode(mode, modeState);
+    CountUsageEvent(EnterModeUsage);
+    CountModeTime(CurrentMode);
+    Log(F("push Layer: "), GetModeString(mode));
+    CurrentMode = mode;
+    CurrentModeState = modeState;
+    return Restart;
+}
+
+// typing, with mode as a layer on top of it
+ControlCode EnterTypingLayer(Mode mode) {
+    SetMode(NormalTypingMode, Used);
+    return PushLayer(mode, Used);
+}
+
+void SetConfiguration(KeyboardLayout layout, Mode entryPointMode) {
     CurrentLayout = layout;
     EntryPointMode = entryPointMode;
-    Log("new entry point Mode: " + GetModeString(entryPointMode));
+    SelectPolicies();
+    InvalidateTransformCache();
+    Log(F("new entry point Mode: "), GetModeString(entryPointMode));
+}
+
+ControlCode ChangeProfile(uint8_t index) {
+    NoteTransformSideEffect();
+    CurrentModeState = Used;
+    if (!MappingOnly) ActivateProfile(index);
     return Stop;
 }
 
+// Replace one entry of the custom layout. CustomKeymapTask persists it a byte at a time, so
+// an upload never blocks the key path for the EEPROM's write time.
+bool SetCustomKeySpec(uint8_t index, KeySpec keySpec) {
+    if (index >= NumLayoutKeys) return false;
+    if (!SavingCustomKeymap && EEPROM.read(CustomKeymapValidSlot) != CustomKeymapValidMarker) {
+        // first upload: persist the qwerty defaults for the entries not being replaced
+        memset(CustomKeymapUnsaved, 0xFF, sizeof(CustomKeymapUnsaved));
+    }
+    customKeymap[index] = keySpec;
+    // an entry replaced while being written is written again
+    CustomKeymapUnsaved[index / 8] |= 1 << (index % 8);
+    SavingCustomKeymap = true;
+    SelectPolicies();
+    InvalidateTransformCache();
+    return true;
+}
+
+bool IsSavingCustomKeymap() {
+    return SavingCustomKeymap;
+}
+
+// Called from loop(): clears the valid marker, writes the next byte of an unsaved custom layout
+// entry, then sets the marker again. A layout only loads once all of it is in EEPROM, never a
+// mix of an old and a new one after a power loss.
+void CustomKeymapTask() {
+    if (!SavingCustomKeymap || !eeprom_is_ready()) return;
+    if (!CustomKeymapMarkerCleared) {
+        EEPROM.update(CustomKeymapValidSlot, 0xFF);
+        CustomKeymapMarkerCleared = true;
+        return;
+    }
+    if (CustomKeymapSaveByte == 0) {
+        uint8_t index = 0;
+        while (index < NumLayoutKeys && !(CustomKeymapUnsaved[index / 8] & (1 << (index % 8)))) index++;
+        if (index == NumLayoutKeys) {
+            EEPROM.update(CustomKeymapValidSlot, CustomKeymapValidMarker);
+            SavingCustomKeymap = false;
+            CustomKeymapMarkerCleared = false;
+            return;
+        }
+        CustomKeymapUnsaved[index / 8] &= ~(1 << (index % 8));
+        CustomKeymapSaveEntry = index;
+    }
+    const uint8_t *bytes = (const uint8_t *)&customKeymap[CustomKeymapSaveEntry];
+    EEPROM.update(CustomKeymapSlot + CustomKeymapSaveEntry * sizeof(KeySpec) + CustomKeymapSaveByte,
+                  bytes[CustomKeymapSaveByte]);
+    CustomKeymapSaveByte = (CustomKeymapSaveByte + 1) % sizeof(KeySpec);
+}
+
 ControlCode _sendKeyCombo(uint8_t mods, uint8_t keycode, uint8_t outbuf[8], bool realmods) {
     CurrentModeState = Used;
     MergeKeyIntoBuffer((RichKey){ mods, keycode }, outbuf, realmods);
@@ -1115,6 +1255,12 @@ ControlCode SendModifiers(uint8_t mods, uint8_t outbuf[8]) {
     return _sendKeyCombo(mods, 0, outbuf, true);
 }
 
+// SendModifiers, that also arms mods for the next key when the key is tapped on its own (see oneshot.h)
+ControlCode SendOneShotModifiers(uint8_t mods, uint8_t outbuf[8]) {
+    NoteOneShotTrigger(mods);
+    return SendModifiers(mods, outbuf);
+}
+
 ControlCode UnsetModifiers(uint8_t mods, uint8_t outbuf[8]) {
     outbuf[0] &= ~mods;
     return Continue;
@@ -1140,14 +1286,69 @@ ControlCode SendRichKey(RichKey key, uint8_t outbuf[8]) {
     return Continue;
 }
 
+// the next keys typed are a leader sequence (see leader.h)
+ControlCode StartLeaderSequence() {
+    NoteTransformSideEffect();
+    CurrentModeState = Used;
+    if (!MappingOnly) StartLeader();
+    return Stop;
+}
+
+// type a character the keyboard has no key for (see typing.h), once per press of key
+ControlCode SendUnicode(uint32_t codePoint, uint8_t key) {
+    NoteTransformSideEffect();
+    CurrentModeState = Used;
+    if (!MappingOnly) TypeCharacter(codePoint, key);
+    return Continue;
+}
+
+// record, play or save the dynamic macro (see macros.h)
+ControlCode MacroKey(MacroCommand command, uint8_t key) {
+    NoteTransformSideEffect();
+    CurrentModeState = Used;
+    if (!MappingOnly) RunMacroCommand(command, key);
+    return Stop;
+}
+
 ControlCode InvalidKey() {
+    CountUsageEvent(InvalidKeyUsage);
     CurrentModeState = Used;
     return Stop;
 }
 
-// map key presses according to the current mode
+// map key presses according to the compiled keymap of the mode being mapped
+ControlCode MapKeyNative(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]) {
+    return KeyMaps[MappedMode](inbuf, i, outbuf);
+}
+
+// map key presses according to mode, preferring an uploaded keymap program
+ControlCode MapModeKey(Mode mode, uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]) {
+    MappedMode = mode;
+    if (HasKeymapProgram(mode))
+        return RunKeymapProgram(mode, inbuf, i, outbuf);
+    return KeyMaps[mode](inbuf, i, outbuf);
+}
+
+// map key presses according to the layer stack: from the top until a layer doesn't fall through,
+// skipping to the layer remembered for the key once the top has seen the report (see layers.h)
 ControlCode MapKey(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]) {
-    return KeyMaps[CurrentMode](inbuf, i, outbuf);
+    uint8_t level = NumLowerLayers;
+    uint8_t resolved = (i >= 2 && HasLowerLayers()) ? ResolvedLayerFor(inbuf[i]) : UnresolvedLayer;
+    if (TopLayerMapped && resolved != UnresolvedLayer) level = resolved;
+    while (true) {
+        if (level == NumLowerLayers) TopLayerMapped = true;
+        Mode mode = level == NumLowerLayers ? CurrentMode : LowerLayers[level];
+        ControlCode code = MapModeKey(mode, inbuf, i, outbuf);
+        if (code != FallThrough) {
+            // Restart means the stack has changed
+            if (i >= 2 && code != Restart && HasLowerLayers()) NoteResolvedLayer(inbuf[i], level);
+            return code;
+        }
+        if (level == 0) return mapNormalKeyToCurrentLayout(inbuf, i, outbuf);
+        level--;
+        // the layers in between fell through for this key before
+        if (resolved < level) level = resolved;
+    }
 }
 
 
@@ -1160,6 +1361,7 @@ String GetOSModeString(OSMode osMode) {
     switch (osMode){
         case Windows:    return "Win";
         case OSX:        return "OSX";
+        default:         return "<unknown>";
     }
 }
 
@@ -1190,6 +1392,10 @@ String GetModeString(Mode mode) {
         case BlackDesertCapsLockMode: return "BlackDesertCapsLock";
         case BlackDesertSpaceMode:    return "BlackDesertSpace";
         case BlackDesertAltMode:      return "BlackDesertAlt";
+        case CustomMode1:             return "Custom1";
+        case CustomMode2:             return "Custom2";
+        case CustomMode3:             return "Custom3";
+        case CustomMode4:             return "Custom4";
         default:                      return "<unknown>";
     }
 }
@@ -1203,6 +1409,8 @@ String GetLayoutString(KeyboardLayout layout) {
         case qwerty:    return "QY";
         case dvorak:    return "DV";
         // case dvorakProgrammer:   return "DVP";
+        case custom:    return "CU";
+        default:        return "<unknown>";
     }
 }
 
@@ -1212,12 +1420,70 @@ String GetLayoutString(KeyboardLayout layout) {
 
 void InitializeState() {
     LoadOSMode();
+    LoadCustomKeymap();
+    LoadKeymapPrograms();
+    LoadTunings();
+    LoadUsage();
+    LoadMacro();
+    InvalidateTransformCache();
+}
+
+// True if TransformBuffer would turn inbuf into the same keys, without modifiers, and change
+// nothing but CurrentModeState: plain keys in the gaming entry point modes with an identity layout.
+// The first key must not be one the entry point keymap handles itself, keep these in sync with
+// GamingEntryPoint_keymap and BlackDesertEntryPoint_keymap.
+bool CanPassThrough(uint8_t inbuf[8]) {
+    if (CurrentMode != GamingNoKeysMode && CurrentMode != BlackDesertNoKeysMode) return false;
+    if (!CurrentLayoutIsIdentity || inbuf[0] || HasKeymapProgram(CurrentMode)) return false;
+
+    uint8_t first = inbuf[2];
+    if (first == 0 || first == _Escape || first == _Backtick || first == _CapsLock || first == _Space) return false;
+    if ((first >= _F1 && first <= _F6) || (first >= _1 && first <= _6)) return false;
+    if (first == _Tab && CurrentMode == GamingNoKeysMode) return false;
+    // CapsLock maps to a modifier wherever it is
+    for (uint8_t i = 3; i < 8; i++) {
+        if (inbuf[i] == _CapsLock) return false;
+    }
+    return true;
+}
+
+// what TransformBuffer does for a report CanPassThrough accepts
+void PassThroughBuffer(uint8_t inbuf[8], uint8_t outbuf[8]) {
+    CurrentModeState = Used;
+    uint8_t n = 2;
+    for (uint8_t i = 2; i < 8; i++) {
+        if (inbuf[i]) outbuf[n++] = inbuf[i];
+    }
+}
+
+// The shift a key pressed by the last transformation needs, if it differs from that of other keys
+// pressed along with it. NoShiftNeed otherwise.
+uint8_t ShiftNeededFor(uint8_t key) {
+    if (!ShiftConflict) return NoShiftNeed;
+    for (uint8_t i = 0; i < NumShiftNeeds; i++) {
+        if (ShiftNeedKeys[i] == key) return ShiftNeedMods[i];
+    }
+    return NoShiftNeed;
+}
+
+void ClearShiftNeeds() {
+    NumShiftNeeds = 0;
+    ShiftConflict = false;
+}
+
+// the key CurrentLayout types for key without shift
+uint8_t LayoutKeyFor(uint8_t key) {
+    if (key >= _A && key < _CapsLock) return ResolvedLayout[0][key - _A].key;
+    return key;
 }
 
 void TransformBuffer(uint8_t inbuf[8], uint8_t outbuf[8]) {
+    ClearShiftNeeds();
     if (NumKeysOrModsPressed(inbuf) == 0) {
         HandleLastKeyReleased();
     } else {
+        StartKeymapProgramReport();
+        TopLayerMapped = false;
         int i = 0;
         while (i < 8) {
             if (i==1 || !inbuf[i]) {
@@ -1225,11 +1491,14 @@ void TransformBuffer(uint8_t inbuf[8], uint8_t outbuf[8]) {
                 continue;
             }
             switch (MapKey(inbuf, i, outbuf)) {
+                // MapKey resolves FallThrough, ending at the current layout
+                case FallThrough:
                 case Continue: i++; break;
                 case Stop: i=8; break;
-                case Restart: i=0; break;
+                case Restart: i=0; TopLayerMapped = false; break;
             }
         }
+        EndKeymapProgramReport();
     }
 }
 
@@ -2,9 +2,129 @@
 #define __KEYMAP_H_
 
 #include <Arduino.h>
+#include "keys.h"
+#include "macros.h"
+
+// ****************************************************************************
+// Type Declarations
+// ****************************************************************************
+
+// Operating System Modes
+typedef enum {
+    Windows = 0,
+    OSX
+} OSMode;
+
+#define NumOSModes (OSX + 1)
+
+// Keyboard Layouts
+typedef enum {
+    qwerty = 0,
+    dvorak,
+    // dvorakProgrammer,
+    custom
+} KeyboardLayout;
+
+#define NumKeyboardLayouts (custom + 1)
+
+// the available keyboard modes
+typedef enum
+{
+    NormalNoKeysMode = 0,
+    ModalNoKeysMode,
+    EscapeMode,
+    CapsLockMode,
+    RightCtrlMode,
+    NormalTypingMode,
+    ModalTypingMode,
+    LeftAltMode,
+    LeftModMode,
+    RightAltMode,
+    RightModMode,
+    AltTabMode,
+    WindowSnapMode,
+    NumPadMode,
+    GamingNoKeysMode,
+    GamingBacktickMode,
+    GamingTabMode,
+    GamingCapsLockMode,
+    GamingShiftMode,
+    GamingCtrlMode,
+    GamingAltMode,
+    GamingSpaceMode,
+    BlackDesertNoKeysMode,
+    BlackDesertCapsLockMode,
+    BlackDesertSpaceMode,
+    BlackDesertAltMode,
+    CustomMode1,
+    CustomMode2,
+    CustomMode3,
+    CustomMode4
+} Mode;
+
+#define NumModes (CustomMode4 + 1)
+
+typedef enum {
+    Clean = 0,
+    Used
+} ModeState;
+
+// specifies action to perform after returning from a call to a KeyMapFunc function with a specific key
+typedef enum {
+    Continue = 0,
+    Stop,
+    Restart,
+    FallThrough         // not mapped by this mode, try the layer below (see layers.h)
+} ControlCode;
+
+// ShiftNeededFor() of keys without a conflicting shift
+#define NoShiftNeed 0xFF
+
+// ****************************************************************************
+// Shared Variables
+// ****************************************************************************
+
+extern KeyboardLayout CurrentLayout;
+extern Mode EntryPointMode;
+extern Mode CurrentMode;
+extern OSMode CurrentOSMode;
+extern ModeState CurrentModeState;
+
+// ****************************************************************************
+// Shared Functions
+// ****************************************************************************
 
 extern void InitializeState();
 extern void TransformBuffer(uint8_t buf[8], uint8_t outbuf[8]);
+extern bool CanPassThrough(uint8_t inbuf[8]);
+extern void PassThroughBuffer(uint8_t inbuf[8], uint8_t outbuf[8]);
+extern uint8_t ShiftNeededFor(uint8_t key);
+extern void ClearShiftNeeds();
+extern uint8_t LayoutKeyFor(uint8_t key);
 extern String GetStateString();
+extern void SetMode(Mode mode, ModeState modeState);
+extern void SetOSMode(OSMode osMode);
+extern void SetConfiguration(KeyboardLayout layout, Mode entryPointMode);
+extern bool SetCustomKeySpec(uint8_t index, KeySpec keySpec);
+
+// set while keymaps run only to be timed: actions with effects beyond outbuf and the mode skip them
+extern bool MappingOnly;
+extern bool IsSavingCustomKeymap();
+extern void CustomKeymapTask();
+
+// actions available to keymaps
+extern ControlCode EnterMode(Mode mode, ModeState modeState);
+extern ControlCode PushLayer(Mode mode, ModeState modeState);
+extern ControlCode SendKey(uint8_t keycode, uint8_t outbuf[8]);
+extern ControlCode SendModifiers(uint8_t mods, uint8_t outbuf[8]);
+extern ControlCode SendOneShotModifiers(uint8_t mods, uint8_t outbuf[8]);
+extern ControlCode SendKeyCombo(uint8_t mods, uint8_t keycode, uint8_t outbuf[8]);
+extern ControlCode SendOnlyKey(uint8_t keycode, uint8_t outbuf[8]);
+extern ControlCode SendUnicode(uint32_t codePoint, uint8_t key);
+extern ControlCode StartLeaderSequence();
+extern ControlCode MacroKey(MacroCommand command, uint8_t key);
+extern ControlCode InvalidKey();
+extern ControlCode mapNormalKeyToCurrentLayout(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]);
+extern ControlCode MapKeyNative(uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]);
 
 #endif // __KEYMAP_H_
@@ -0,0 +1,264 @@
+#include "modal_keys.h"
+#include "keymap_vm.h"
+#include "eeprom_layout.h"
+#include "helpers.h"
+#include "layers.h"
+#include "stats.h"
+#include "usage.h"
+#include "transform_cache.h"
+
+#include <EEPROM.h>
+
+#define InvalidOpcode 0xFF
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+// offset of each mode's program within the program image, or NoKeymapProgram
+uint8_t KeymapProgramOffsets[NumModes];
+
+// instructions executed so far for the report being transformed
+uint8_t ReportInstructions = 0;
+uint8_t LastReportInstructions = 0;
+
+// the part of the image KeymapProgramTask is writing: ProgramChunk[ProgramChunkWritten, ProgramChunkLength)
+// still has to go to ProgramChunkOffset onwards
+uint8_t ProgramChunk[MaxProgramImageChunk];
+uint8_t ProgramChunkOffset = 0;
+uint8_t ProgramChunkLength = 0;
+uint8_t ProgramChunkWritten = 0;
+
+// ****************************************************************************
+// Helper Functions
+// ****************************************************************************
+
+bool IsVmCondition(uint8_t op) {
+    return op < VmSendKey;
+}
+
+uint8_t VmOperandCount(uint8_t op) {
+    switch (op) {
+        case VmIfAnyMod:
+        case VmIfAnyKey:
+        case VmContinue:
+        case VmStop:
+        case VmRestart:
+        case VmInvalidKey:
+        case VmMapToLayout:
+        case VmNative:
+        case VmStartLeader:
+            return 0;
+        case VmIfMod:
+        case VmIfFirstKey:
+        case VmIfKey:
+        case VmIfFirstKeyNot:
+        case VmIfOnlyMods:
+        case VmSendKey:
+        case VmSendModifiers:
+        case VmSendOneShotModifiers:
+        case VmSendOnlyKey:
+            return 1;
+        case VmSendKeyCombo:
+        case VmEnterMode:
+            return 2;
+    }
+    return InvalidOpcode;
+}
+
+uint8_t ReadProgramByte(uint8_t offset) {
+    return EEPROM.read(KeymapProgramsSlot + offset);
+}
+
+// checks that every instruction is known, fits in the program, and that the last case has no conditions
+bool ValidateKeymapProgram(uint8_t start, uint8_t length) {
+    uint8_t pc = start;
+    uint8_t end = start + length;
+    bool caseHasCondition = false;
+    bool endsUnconditionally = false;
+    while (pc < end) {
+        uint8_t op = ReadProgramByte(pc);
+        uint8_t operands = VmOperandCount(op);
+        if (operands == InvalidOpcode || pc + 1 + operands > end) return false;
+        if (op == VmEnterMode) {
+            if (ReadProgramByte(pc + 1) >= NumModes || ReadProgramByte(pc + 2) > Used) return false;
+        }
+        if (IsVmCondition(op)) {
+            caseHasCondition = true;
+        } else {
+            endsUnconditionally = !caseHasCondition;
+            caseHasCondition = false;
+        }
+        pc += 1 + operands;
+    }
+    return endsUnconditionally && !caseHasCondition;
+}
+
+void ClearKeymapPrograms() {
+    for (uint8_t mode = 0; mode < NumModes; mode++) {
+        KeymapProgramOffsets[mode] = NoKeymapProgram;
+    }
+    InvalidateTransformCache();
+}
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+void LoadKeymapPrograms() {
+    ClearKeymapPrograms();
+    uint8_t offset = 0;
+    while (offset + 2 <= KeymapProgramsSize) {
+        uint8_t mode = ReadProgramByte(offset);
+        uint8_t length = ReadProgramByte(offset + 1);
+        if (mode == VmEndOfImage) return;
+        if (mode >= NumModes || offset + 2 + length > KeymapProgramsSize
+                || !ValidateKeymapProgram(offset + 2, length)) {
+            break;
+        }
+        KeymapProgramOffsets[mode] = offset + 2;
+        offset += 2 + length;
+    }
+    // an image without a terminator, or with a bad program, is ignored as a whole
+    ClearKeymapPrograms();
+    Log(F("keymap programs invalid at offset "), String(offset));
+}
+
+// Write part of a new program image, once the part before it is in EEPROM (see
+// IsWritingKeymapPrograms). Programs stay disabled until the image is committed.
+bool WriteKeymapProgramImage(uint8_t offset, const uint8_t *data, uint8_t length) {
+    if (length > MaxProgramImageChunk || offset + length > KeymapProgramsSize) return false;
+    ClearKeymapPrograms();
+    memcpy(ProgramChunk, data, length);
+    ProgramChunkOffset = offset;
+    ProgramChunkLength = length;
+    ProgramChunkWritten = 0;
+    return true;
+}
+
+// Validate the image and load its programs; only once all of it is in EEPROM.
+bool CommitKeymapProgramImage() {
+    LoadKeymapPrograms();
+    for (uint8_t mode = 0; mode < NumModes; mode++) {
+        if (HasKeymapProgram((Mode)mode)) return true;
+    }
+    // accept an empty image, which turns all programs off
+    return ReadProgramByte(0) == VmEndOfImage;
+}
+
+bool IsWritingKeymapPrograms() {
+    return ProgramChunkWritten < ProgramChunkLength;
+}
+
+// Called from loop(): writes the next byte of the uploaded part of the image, so an upload
+// never blocks the key path for the EEPROM's write time.
+void KeymapProgramTask() {
+    if (!IsWritingKeymapPrograms() || !eeprom_is_ready()) return;
+    EEPROM.update(KeymapProgramsSlot + ProgramChunkOffset + ProgramChunkWritten, ProgramChunk[ProgramChunkWritten]);
+    ProgramChunkWritten++;
+}
+
+void StartKeymapProgramReport() {
+    ReportInstructions = 0;
+}
+
+void EndKeymapProgramReport() {
+    LastReportInstructions = ReportInstructions;
+    Stats[VmInstructionsStat] += ReportInstructions;
+    if (ReportInstructions > Stats[VmMaxReportInstructionsStat])
+        Stats[VmMaxReportInstructionsStat] = ReportInstructions;
+}
+
+ControlCode RunKeymapProgram(Mode mode, uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]) {
+    uint8_t pc = KeymapProgramOffsets[mode];
+    bool skipping = false;
+    while (true) {
+        if (ReportInstructions == MaxVmInstructionsPerReport) {
+            CountStat(VmBudgetExceededStat);
+            return InvalidKey();
+        }
+        ReportInstructions++;
+
+        uint8_t op = ReadProgramByte(pc);
+        if (IsVmCondition(op)) {
+            if (!skipping) switch (op) {
+                case VmIfMod:         skipping = !(i == 0 && inbuf[0] == ReadProgramByte(pc + 1)); break;
+                case VmIfAnyMod:      skipping = !(i == 0); break;
+                case VmIfFirstKey:    skipping = !(i == 2 && inbuf[2] == ReadProgramByte(pc + 1)); break;
+                case VmIfKey:         skipping = !(i >= 2 && inbuf[i] == ReadProgramByte(pc + 1)); break;
+                case VmIfAnyKey:      skipping = !(i >= 2); break;
+                case VmIfFirstKeyNot: skipping = !(inbuf[2] != ReadProgramByte(pc + 1)); break;
+                case VmIfOnlyMods:    skipping = !(inbuf[0] == ReadProgramByte(pc + 1) && NumKeysPressed(inbuf) == 0); break;
+            }
+            pc += 1 + VmOperandCount(op);
+            continue;
+        }
+        if (skipping) {
+            skipping = false;
+            pc += 1 + VmOperandCount(op);
+            continue;
+        }
+        switch (op) {
+            case VmSendKey:       return SendKey(ReadProgramByte(pc + 1), outbuf);
+            case VmSendModifiers: return SendModifiers(ReadProgramByte(pc + 1), outbuf);
+            case VmSendKeyCombo:  return SendKeyCombo(ReadProgramByte(pc + 1), ReadProgramByte(pc + 2), outbuf);
+            case VmSendOnlyKey:   return SendOnlyKey(ReadProgramByte(pc + 1), outbuf);
+            case VmEnterMode:     return EnterMode((Mode)ReadProgramByte(pc + 1), (ModeState)ReadProgramByte(pc + 2));
+            case VmContinue:      return Continue;
+            case VmStop:          return Stop;
+            case VmRestart:       return Restart;
+            case VmMapToLayout:   return mapNormalKeyToCurrentLayout(inbuf, i, outbuf);
+            case VmNative:        return MapKeyNative(inbuf, i, outbuf);
+            case VmSendOneShotModifiers: return SendOneShotModifiers(ReadProgramByte(pc + 1), outbuf);
+            case VmStartLeader:   return StartLeaderSequence();
+        }
+        return InvalidKey();
+    }
+}
+
+// Time `iterations` transformations of inbuf starting in `mode`, first with the compiled keymaps
+// and then with the uploaded program for that mode. Engine state is restored afterwards: the
+// keymaps run with an empty layer stack and MappingOnly set, so actions with lasting effects
+// (leader, macros, typing, OS mode and profile changes) don't happen.
+// The usage event counts are restored too, so benchmarks don't show up as EnterMode/InvalidKey usage.
+KeymapBenchmark BenchmarkKeymapProgram(Mode mode, uint8_t inbuf[8], uint16_t iterations) {
+    KeymapBenchmark result = { 0, 0, 0 };
+    Mode savedMode = CurrentMode;
+    ModeState savedModeState = CurrentModeState;
+    Mode savedLayers[MaxLowerLayers];
+    uint8_t savedNumLayers = NumLowerLayers;
+    bool savedWriteToLog = WriteToLog;
+    uint8_t programOffset = KeymapProgramOffsets[mode];
+    uint32_t savedUsageEvents[NumUsageEvents];
+    memcpy(savedLayers, LowerLayers, sizeof(savedLayers));
+    memcpy(savedUsageEvents, UsageEventDeltas, sizeof(savedUsageEvents));
+    CountModeTime(CurrentMode);
+    WriteToLog = false;
+    MappingOnly = true;
+
+    for (uint8_t pass = 0; pass < 2; pass++) {
+        KeymapProgramOffsets[mode] = pass == 0 ? NoKeymapProgram : programOffset;
+        uint32_t start = micros();
+        for (uint16_t n = 0; n < iterations; n++) {
+            uint8_t outbuf[8] = { 0 };
+            CurrentMode = mode;
+            CurrentModeState = Clean;
+            ClearLayers();
+            TransformBuffer(inbuf, outbuf);
+        }
+        uint32_t elapsed = micros() - start;
+        if (pass == 0) result.nativeMicros = elapsed;
+        else result.programMicros = elapsed;
+    }
+    result.programInstructions = LastReportInstructions;
+
+    KeymapProgramOffsets[mode] = programOffset;
+    CurrentMode = savedMode;
+    CurrentModeState = savedModeState;
+    RestoreLayers(savedLayers, savedNumLayers);
+    MappingOnly = false;
+    WriteToLog = savedWriteToLog;
+    memcpy(UsageEventDeltas, savedUsageEvents, sizeof(savedUsageEvents));
+    ModeEnteredMillis = millis();
+    return result;
+}
@@ -0,0 +1,81 @@
+#if !defined(__KEYMAP_VM_H_)
+#define __KEYMAP_VM_H_
+
+#include <Arduino.h>
+#include "keymap.h"
+
+// Keymap programs are a compact bytecode form of the *_keymap functions, stored in EEPROM
+// so that modes can be changed or added (CustomMode1-4) without recompiling.
+//
+// The program image is a list of per-mode programs, terminated by VmEndOfImage:
+//
+//   mode | length | code[length] ... VmEndOfImage
+//
+// A program is a list of cases. Each case is zero or more conditions followed by one action.
+// When a condition fails the rest of the case is skipped; the first action reached ends
+// the program and returns its ControlCode, like a `return` in a *_keymap function.
+// Every program must end with an unconditional action, e.g. VmNative to fall through to
+// the compiled keymap for keys the program doesn't handle.
+typedef enum {
+    // conditions (operands)
+    VmIfMod = 0x01,         // mods: i == 0 && inbuf[0] == mods
+    VmIfAnyMod,             //       i == 0
+    VmIfFirstKey,           // key:  i == 2 && inbuf[2] == key
+    VmIfKey,                // key:  i >= 2 && inbuf[i] == key
+    VmIfAnyKey,             //       i >= 2
+    VmIfFirstKeyNot,        // key:  inbuf[2] != key
+    VmIfOnlyMods,           // mods: inbuf[0] == mods && no keys are pressed
+
+    // actions (operands)
+    VmSendKey = 0x40,       // key
+    VmSendModifiers,        // mods
+    VmSendKeyCombo,         // mods, key
+    VmSendOnlyKey,          // key
+    VmEnterMode,            // mode, mode state
+    VmContinue,
+    VmStop,
+    VmRestart,
+    VmInvalidKey,
+    VmMapToLayout,          // mapNormalKeyToCurrentLayout
+    VmNative,               // the compiled keymap of the current mode
+    VmSendOneShotModifiers, // mods
+    VmStartLeader           // StartLeaderSequence
+} VmOpcode;
+
+#define VmEndOfImage 0xFF
+#define NoKeymapProgram 0xFF
+
+// Upper bound on the instructions executed while transforming one report. Programs are
+// validated on upload, but EnterMode/Restart cycles between modes could still loop forever.
+#define MaxVmInstructionsPerReport 255
+
+// Most bytes of the image in one WriteKeymapProgramImage: what fits in a command frame after the
+// offset. KeymapProgramTask writes them to EEPROM a byte at a time.
+#define MaxProgramImageChunk 31
+
+// BenchmarkCommand holds up the key path while it runs; longer benchmarks take several commands
+#define MaxBenchmarkIterations 64
+
+struct KeymapBenchmark {
+    uint32_t nativeMicros;
+    uint32_t programMicros;
+    uint16_t programInstructions; // executed per report
+};
+
+extern uint8_t KeymapProgramOffsets[NumModes];
+
+inline bool HasKeymapProgram(Mode mode) {
+    return KeymapProgramOffsets[mode] != NoKeymapProgram;
+}
+
+extern void LoadKeymapPrograms();
+extern bool WriteKeymapProgramImage(uint8_t offset, const uint8_t *data, uint8_t length);
+extern bool CommitKeymapProgramImage();
+extern bool IsWritingKeymapPrograms();
+extern void KeymapProgramTask();
+extern void StartKeymapProgramReport();
+extern void EndKeymapProgramReport();
+extern ControlCode RunKeymapProgram(Mode mode, uint8_t inbuf[8], uint8_t i, uint8_t outbuf[8]);
+extern KeymapBenchmark BenchmarkKeymapProgram(Mode mode, uint8_t inbuf[8], uint16_t iterations);
+
+#endif // __KEYMAP_VM_H_
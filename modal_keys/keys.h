@@ -149,6 +149,9 @@ struct RichKey {
     uint8_t flags;
 };
 
+// number of keys (_A to _CapsLock) covered by a KeySpec layout table
+#define NumLayoutKeys (_CapsLock - _A + 1)
+
 struct KeySpec {
     uint8_t shift1; // shift modifiers when shift is not pressed
     uint8_t key1; // the key to map to when shift is not pressed
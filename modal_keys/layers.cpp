@@ -0,0 +1,58 @@
+#include "layers.h"
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+// from the bottom up; CurrentMode is the top
+Mode LowerLayers[MaxLowerLayers];
+uint8_t NumLowerLayers = 0;
+
+// per key from FirstLayerKey: the level (index into LowerLayers, NumLowerLayers for CurrentMode)
+// of the layer that maps it, or UnresolvedLayer
+uint8_t ResolvedLayers[LastLayerKey - FirstLayerKey + 1];
+
+// ****************************************************************************
+// Helper Functions
+// ****************************************************************************
+
+void ForgetResolvedLayers() {
+    for (uint8_t i = 0; i < sizeof(ResolvedLayers); i++) {
+        ResolvedLayers[i] = UnresolvedLayer;
+    }
+}
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+void ClearLayers() {
+    if (!NumLowerLayers) return;
+    NumLowerLayers = 0;
+    ForgetResolvedLayers();
+}
+
+// put mode below the new top; false if the stack is full
+bool PushLowerLayer(Mode mode) {
+    if (NumLowerLayers == MaxLowerLayers) return false;
+    LowerLayers[NumLowerLayers++] = mode;
+    ForgetResolvedLayers();
+    return true;
+}
+
+// put back a stack saved from LowerLayers, e.g. after a keymap benchmark
+void RestoreLayers(const Mode lower[MaxLowerLayers], uint8_t count) {
+    memcpy(LowerLayers, lower, sizeof(LowerLayers));
+    NumLowerLayers = count;
+    ForgetResolvedLayers();
+}
+
+uint8_t ResolvedLayerFor(uint8_t key) {
+    if (key < FirstLayerKey || key > LastLayerKey) return UnresolvedLayer;
+    return ResolvedLayers[key - FirstLayerKey];
+}
+
+void NoteResolvedLayer(uint8_t key, uint8_t level) {
+    if (key < FirstLayerKey || key > LastLayerKey) return;
+    ResolvedLayers[key - FirstLayerKey] = level;
+}
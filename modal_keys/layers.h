@@ -0,0 +1,40 @@
+#if !defined(__LAYERS_H_)
+#define __LAYERS_H_
+
+#include <Arduino.h>
+#include "keys.h"
+#include "keymap.h"
+
+// Layer stack: PushLayer puts a mode on top of CurrentMode, which stays active underneath it.
+// Keys the top mode's keymap returns FallThrough for go to the modes below, and from the
+// bottom one to the current layout. Which layer maps each key is remembered until the stack
+// changes, so once resolved a key costs one keymap call however deep the stack is, plus one
+// call of the top keymap per report, which checks its exit condition (e.g. WindowSnap_keymap's
+// first key no longer being C). A keymap used as a layer must otherwise decide whether to fall
+// through from the key alone, not from its position or the other keys pressed.
+//
+// SetMode (EnterMode, the last key being released) empties the stack.
+
+// modes below CurrentMode
+#define MaxLowerLayers 3
+
+// keys whose layer is remembered; others are resolved every time
+#define FirstLayerKey _A
+#define LastLayerKey _Up
+
+#define UnresolvedLayer 0xFF
+
+extern Mode LowerLayers[MaxLowerLayers];
+extern uint8_t NumLowerLayers;
+
+inline bool HasLowerLayers() {
+    return NumLowerLayers != 0;
+}
+
+extern void ClearLayers();
+extern bool PushLowerLayer(Mode mode);
+extern void RestoreLayers(const Mode lower[MaxLowerLayers], uint8_t count);
+extern uint8_t ResolvedLayerFor(uint8_t key);
+extern void NoteResolvedLayer(uint8_t key, uint8_t level);
+
+#endif // __LAYERS_H_
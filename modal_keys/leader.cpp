@@ -0,0 +1,119 @@
+#include "modal_keys.h"
+#include "leader.h"
+#include "leader_trie.h"
+#include "keymap.h"
+#include "helpers.h"
+#include "profiles.h"
+#include "tuning.h"
+
+// ****************************************************************************
+// Type Declarations
+// ****************************************************************************
+
+typedef enum {
+    LeaderOff = 0,
+    LeaderMatching,
+    LeaderFinishing         // done, waiting for the keys to be released
+} LeaderState;
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+LeaderState CurrentLeaderState = LeaderOff;
+// first edge of the node reached by the keys typed so far
+uint8_t LeaderNode = 0;
+uint32_t LeaderKeyMillis = 0;
+// the last report seen, to tell new key presses from held keys
+uint8_t LeaderPreviousBuffer[8] = { 0 };
+
+// ****************************************************************************
+// Helper Functions
+// ****************************************************************************
+
+void RunLeaderAction(uint8_t index) {
+    LeaderAction action;
+    memcpy_P(&action, &LeaderActions[index], sizeof(LeaderAction));
+    switch (action.kind) {
+        case LeaderProfile:
+            ActivateProfile(action.value);
+            break;
+        case LeaderOSMode:
+            if (action.value != CurrentOSMode) SetOSMode((OSMode)action.value);
+            break;
+        case LeaderLayout:
+            SetConfiguration((KeyboardLayout)action.value, EntryPointMode);
+            CurrentProfile = NoProfile;
+            break;
+        case LeaderEntryPoint:
+            SetConfiguration(CurrentLayout, (Mode)action.value);
+            CurrentProfile = NoProfile;
+            break;
+    }
+}
+
+void FinishLeader() {
+    CurrentLeaderState = LeaderFinishing;
+    if (NumKeysOrModsPressed(LeaderPreviousBuffer) == 0) {
+        CurrentLeaderState = LeaderOff;
+        SetMode(EntryPointMode, Clean);
+    }
+}
+
+// follow the edge for key out of the current node
+void StepLeader(uint8_t key) {
+    for (uint8_t e = LeaderNode; ; e++) {
+        LeaderEdge edge;
+        memcpy_P(&edge, &LeaderTrie[e], sizeof(LeaderEdge));
+        if (edge.key == 0) {
+            Log(F("leader: no sequence"));
+            FinishLeader();
+            return;
+        }
+        if (edge.key != key) continue;
+
+        if (edge.target & LeaderLeaf) {
+            RunLeaderAction(edge.target & ~LeaderLeaf);
+            FinishLeader();
+        } else {
+            LeaderNode = edge.target;
+            LeaderKeyMillis = millis();
+        }
+        return;
+    }
+}
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+// called by StartLeaderSequence; the keys held now (the leader key) are not part of the sequence
+void StartLeader() {
+    CurrentLeaderState = LeaderMatching;
+    LeaderNode = 0;
+    LeaderKeyMillis = millis();
+    CopyBuf(InputBuffer, LeaderPreviousBuffer);
+    Log(F("leader"));
+}
+
+bool LeaderActive() {
+    return CurrentLeaderState != LeaderOff;
+}
+
+// takes the reports while LeaderActive()
+void FeedLeader(uint8_t buf[8]) {
+    for (uint8_t i = 2; i < 8; i++) {
+        if (CurrentLeaderState == LeaderMatching && buf[i] && !IsKeyPressedInBuffer(buf[i], LeaderPreviousBuffer))
+            StepLeader(LayoutKeyFor(buf[i]));
+    }
+    CopyBuf(buf, LeaderPreviousBuffer);
+    if (CurrentLeaderState == LeaderFinishing) FinishLeader();
+}
+
+// called from loop()
+void LeaderTask() {
+    if (CurrentLeaderState != LeaderMatching || !Tunings[LeaderTimeoutTuning]) return;
+    if (millis() - LeaderKeyMillis < Tunings[LeaderTimeoutTuning]) return;
+    Log(F("leader: timed out"));
+    FinishLeader();
+}
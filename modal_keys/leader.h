@@ -0,0 +1,38 @@
+#if !defined(__LEADER_H_)
+#define __LEADER_H_
+
+#include <Arduino.h>
+
+// Leader sequences: after the leader key (Escape+Space), the next keys typed are matched against
+// a list of short sequences instead of going to the mode engine, e.g. "p2" activates profile 2.
+// The sequences are compiled by tools/leader_trie.py into a trie in flash (leader_trie.h), so
+// each key costs one scan of the current node's edges. The sequence is abandoned on a key that
+// doesn't continue it, or after LeaderTimeoutTuning ms without a key.
+
+// what a completed sequence does
+typedef enum {
+    LeaderProfile = 0,      // ActivateProfile(value)
+    LeaderOSMode,           // SetOSMode(value)
+    LeaderLayout,           // the layout, keeping the entry point mode
+    LeaderEntryPoint        // the entry point mode, keeping the layout
+} LeaderActionKind;
+
+// target of an edge that completes a sequence: LeaderLeaf | action index
+#define LeaderLeaf 0x80
+
+struct LeaderEdge {
+    uint8_t key;            // as typed with the current layout; 0 ends the node
+    uint8_t target;         // index of the child node's first edge, or LeaderLeaf | action index
+};
+
+struct LeaderAction {
+    uint8_t kind;
+    uint8_t value;
+};
+
+extern void StartLeader();
+extern bool LeaderActive();
+extern void FeedLeader(uint8_t buf[8]);
+extern void LeaderTask();
+
+#endif // __LEADER_H_
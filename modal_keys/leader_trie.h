@@ -0,0 +1,35 @@
+#if !defined(__LEADER_TRIE_H_)
+#define __LEADER_TRIE_H_
+
+// generated by tools/leader_trie.py from tools/leader_sequences.txt, don't edit
+
+#include "keys.h"
+#include "keymap.h"
+#include "leader.h"
+
+// the edges of each node, each node ending with key 0; the root is the first
+const LeaderEdge LeaderTrie[] PROGMEM = {
+    /*   0 -    */ { _E, 5 }, { _L, 10 }, { _O, 14 }, { _P, 17 }, { 0, 0 },
+    /*   5 e    */ { _B, LeaderLeaf | 12 }, { _G, LeaderLeaf | 11 }, { _M, LeaderLeaf | 10 }, { _N, LeaderLeaf | 9 }, { 0, 0 },
+    /*  10 l    */ { _C, LeaderLeaf | 8 }, { _D, LeaderLeaf | 7 }, { _Q, LeaderLeaf | 6 }, { 0, 0 },
+    /*  14 o    */ { _M, LeaderLeaf | 5 }, { _W, LeaderLeaf | 4 }, { 0, 0 },
+    /*  17 p    */ { _1, LeaderLeaf | 0 }, { _2, LeaderLeaf | 1 }, { _3, LeaderLeaf | 2 }, { _4, LeaderLeaf | 3 }, { 0, 0 },
+};
+
+const LeaderAction LeaderActions[] PROGMEM = {
+    /*   0 p1   */ { LeaderProfile, 0 },
+    /*   1 p2   */ { LeaderProfile, 1 },
+    /*   2 p3   */ { LeaderProfile, 2 },
+    /*   3 p4   */ { LeaderProfile, 3 },
+    /*   4 ow   */ { LeaderOSMode, Windows },
+    /*   5 om   */ { LeaderOSMode, OSX },
+    /*   6 lq   */ { LeaderLayout, qwerty },
+    /*   7 ld   */ { LeaderLayout, dvorak },
+    /*   8 lc   */ { LeaderLayout, custom },
+    /*   9 en   */ { LeaderEntryPoint, NormalNoKeysMode },
+    /*  10 em   */ { LeaderEntryPoint, ModalNoKeysMode },
+    /*  11 eg   */ { LeaderEntryPoint, GamingNoKeysMode },
+    /*  12 eb   */ { LeaderEntryPoint, BlackDesertNoKeysMode },
+};
+
+#endif // __LEADER_TRIE_H_
@@ -0,0 +1,107 @@
+#include "modal_keys.h"
+#include "leds.h"
+#include "keymap.h"
+#include "profiles.h"
+#include "stats.h"
+
+// ****************************************************************************
+// Constants
+// ****************************************************************************
+
+// KeyboardLeds before the keyboard has taken any
+#define NoLeds 0xFF
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+// as last reported by the host; HostLedsKnown once it has
+uint8_t HostLeds = 0;
+bool HostLedsKnown = false;
+
+// as last taken by the keyboard
+uint8_t KeyboardLeds = NoLeds;
+uint32_t KeyboardLedsSentMillis = 0;
+
+// being sent, while SetKeyboardLeds is part way through
+uint8_t PendingKeyboardLeds = NoLeds;
+uint32_t PendingKeyboardLedsMicros = 0;
+
+// the configuration shown, and since when; 0xFF before the first one
+uint8_t LedLayout = 0xFF;
+uint8_t LedOSMode = 0xFF;
+uint8_t LedProfile = 0xFF;
+uint32_t LedFlashSince = 0;
+
+// ****************************************************************************
+// Helper Functions
+// ****************************************************************************
+
+// Only modes that stay on without keys held are shown: the chord modes change with nearly every
+// chord, and each change would put a control transfer ahead of the next USB poll.
+bool InGamingMode() {
+    return EntryPointMode == GamingNoKeysMode || EntryPointMode == BlackDesertNoKeysMode;
+}
+
+// restarts the flash when the configuration differs from the one last shown
+void NoteConfiguration(uint32_t now) {
+    if (LedLayout == CurrentLayout && LedOSMode == CurrentOSMode && LedProfile == CurrentProfile) return;
+    LedLayout = CurrentLayout;
+    LedOSMode = CurrentOSMode;
+    LedProfile = CurrentProfile;
+    LedFlashSince = now;
+}
+
+uint8_t ConfigurationLeds() {
+    uint8_t leds = CurrentOSMode == OSX ? NumLockLed : 0;
+    switch (CurrentLayout) {
+        case qwerty: return leds | ScrollLockLed;
+        case dvorak: return leds | CapsLockLed;
+        default:     return leds | CapsLockLed | ScrollLockLed;
+    }
+}
+
+uint8_t WantedLeds(uint32_t now) {
+    if (!HostLedsKnown || now - LedFlashSince < LedFlashMillis) return ConfigurationLeds();
+    return HostLeds | (InGamingMode() ? ScrollLockLed : 0);
+}
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+// the platform's report of the host's LEDs (see SetHostLedsCommand)
+void SetHostLeds(uint8_t leds) {
+    HostLeds = leds & (NumLockLed | CapsLockLed | ScrollLockLed);
+    HostLedsKnown = true;
+}
+
+// the keyboard has forgotten its LEDs, e.g. after it was plugged in again
+void ResendKeyboardLeds() {
+    KeyboardLeds = NoLeds;
+}
+
+// called from loop()
+void LedTask() {
+    uint32_t now = millis();
+    NoteConfiguration(now);
+    if (PendingKeyboardLeds == NoLeds) {
+        uint8_t leds = WantedLeds(now);
+        if (leds == KeyboardLeds || now - KeyboardLedsSentMillis < LedMinIntervalMillis) return;
+        KeyboardLedsSentMillis = now;
+        PendingKeyboardLeds = leds;
+        PendingKeyboardLedsMicros = micros();
+    }
+
+    KeyboardLedsProgress progress = SetKeyboardLeds(PendingKeyboardLeds);
+    if (progress == KeyboardLedsPending) return;
+    uint8_t leds = PendingKeyboardLeds;
+    PendingKeyboardLeds = NoLeds;
+    // not taken: tried again after the interval
+    if (progress == KeyboardLedsFailed) return;
+    KeyboardLeds = leds;
+
+    uint32_t elapsed = micros() - PendingKeyboardLedsMicros;
+    CountStat(KeyboardLedReportsStat);
+    if (elapsed > Stats[KeyboardLedMaxMicrosStat]) Stats[KeyboardLedMaxMicrosStat] = elapsed;
+}
@@ -0,0 +1,41 @@
+#if !defined(__LEDS_H_)
+#define __LEDS_H_
+
+#include <Arduino.h>
+
+// The keyboard's LEDs show the host's lock state together with the engine's:
+//  - Num Lock and Caps Lock are the host's
+//  - Scroll Lock is the host's, and also lit while the entry point is one of the gaming modes
+//  - for LedFlashMillis after the layout, OS mode or profile changes, and after startup, they show
+//    the configuration instead: Num Lock for OSX, Caps Lock and Scroll Lock the layout, as
+//    qwerty = Scroll, dvorak = Caps, custom = both
+//  - where the platform never reports the host's LEDs (the Leonardo), they show the configuration
+//    all the time
+//
+// LedTask works the state out and sends it to the keyboard only when it changes, at most every
+// LedMinIntervalMillis: setting the LEDs is a control transfer that takes as long as the keyboard
+// likes, so it never happens on the key path, and one the keyboard is slow to take is continued on
+// the next run rather than waited for.
+
+// HID LED bits, in the host's and the keyboard's output reports
+#define NumLockLed 0x01
+#define CapsLockLed 0x02
+#define ScrollLockLed 0x04
+
+#define LedFlashMillis 1500
+#define LedMinIntervalMillis 50
+
+typedef enum {
+    KeyboardLedsSent = 0,
+    KeyboardLedsPending,        // call again with the same LEDs
+    KeyboardLedsFailed          // not taken, e.g. no keyboard yet
+} KeyboardLedsProgress;
+
+// provided by the platform: sends the LEDs to the keyboard, without waiting for it
+extern KeyboardLedsProgress SetKeyboardLeds(uint8_t leds);
+
+extern void SetHostLeds(uint8_t leds);
+extern void ResendKeyboardLeds();
+extern void LedTask();
+
+#endif // __LEDS_H_
@@ -0,0 +1,227 @@
+#include "modal_keys.h"
+#include "macros.h"
+#include "helpers.h"
+#include "report_queue.h"
+
+#include <EEPROM.h>
+
+// ****************************************************************************
+// Type Declarations
+// ****************************************************************************
+
+typedef enum {
+    MacroIdle = 0,
+    MacroRecording,
+    MacroWaitingToPlay,     // waiting for the keys to be released
+    MacroPlayingBack
+} MacroState;
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+MacroState CurrentMacroState = MacroIdle;
+
+// the recording, starting at MacroHead
+uint8_t MacroBuffer[MacroBufferSize];
+uint8_t MacroHead = 0;
+uint8_t MacroLength = 0;
+
+// while recording: the last report sent; while playing: the last report played
+uint8_t MacroReport[8] = { 0 };
+// while playing: offset of the next change
+uint8_t MacroPlayOffset = 0;
+
+// the key of the last macro command, which doesn't run again until the key is released
+uint8_t MacroCommandKey = 0;
+
+// while saving: the step MacroTask takes next: invalidating the length, writing the byte of the
+// recording before MacroSaveOffset, then the length
+bool SavingMacro = false;
+uint8_t MacroSaveOffset = 0;
+
+// ****************************************************************************
+// Helper Functions
+// ****************************************************************************
+
+uint8_t MacroByte(uint8_t offset) {
+    return MacroBuffer[(MacroHead + offset) % MacroBufferSize];
+}
+
+uint8_t MacroEventSize(uint8_t first) {
+    return first == MacroModsEvent ? 2 : 1;
+}
+
+// append a change of size bytes, dropping the oldest changes if there is no room for it
+void AppendMacroEvent(uint8_t first, uint8_t second, uint8_t size) {
+    if (MacroLength + size > MacroBufferSize) {
+        if (MacroHead == 0 && MacroLength == MacroBufferSize) Log(F("macro: full, dropping the oldest keys"));
+        while (MacroLength + size > MacroBufferSize) {
+            uint8_t dropped = MacroEventSize(MacroByte(0));
+            MacroHead = (MacroHead + dropped) % MacroBufferSize;
+            MacroLength -= dropped;
+        }
+    }
+    MacroBuffer[(MacroHead + MacroLength) % MacroBufferSize] = first;
+    if (size == 2) MacroBuffer[(MacroHead + MacroLength + 1) % MacroBufferSize] = second;
+    MacroLength += size;
+}
+
+// rotate the ring so the recording starts at MacroBuffer[0]
+void StraightenMacro() {
+    uint8_t straight[MacroBufferSize];
+    for (uint8_t i = 0; i < MacroLength; i++) straight[i] = MacroByte(i);
+    memcpy(MacroBuffer, straight, MacroLength);
+    MacroHead = 0;
+}
+
+// apply the change at offset to buf; returns its size
+uint8_t ApplyMacroEvent(uint8_t offset, uint8_t buf[8]) {
+    uint8_t first = MacroByte(offset);
+    if (first == MacroModsEvent) {
+        buf[0] = MacroByte(offset + 1);
+        return 2;
+    }
+    uint8_t key = first & ~MacroReleaseEvent;
+    if (first & MacroReleaseEvent) {
+        for (uint8_t i = 2; i < 8; i++) if (buf[i] == key) buf[i] = 0;
+    } else if (!IsKeyPressedInBuffer(key, buf)) {
+        for (uint8_t i = 2; i < 8; i++) if (!buf[i]) { buf[i] = key; break; }
+    }
+    return 1;
+}
+
+void StartRecording() {
+    MacroHead = 0;
+    MacroLength = 0;
+    memset(MacroReport, 0, sizeof(MacroReport));
+    CurrentMacroState = MacroRecording;
+    Log(F("macro: recording"));
+}
+
+void StopRecording() {
+    StraightenMacro();
+    CurrentMacroState = MacroIdle;
+    Log(F("macro: recorded "), String(MacroLength) + " bytes");
+}
+
+// MacroTask writes the recording a byte at a time, so saving never holds up the key path
+void SaveMacro() {
+    SavingMacro = true;
+    MacroSaveOffset = 0;
+    Log(F("macro: saving"));
+}
+
+void WriteNextMacroByte() {
+    if (MacroSaveOffset == 0) {
+        // a save cut short by a power loss leaves no macro rather than a garbled one
+        EEPROM.update(MacroSlot, 0xFF);
+        MacroSaveOffset++;
+        return;
+    }
+    if (MacroSaveOffset <= MacroLength) {
+        EEPROM.update(MacroSlot + MacroSaveOffset, MacroBuffer[MacroSaveOffset - 1]);
+        MacroSaveOffset++;
+        return;
+    }
+    EEPROM.update(MacroSlot, MacroLength);
+    SavingMacro = false;
+    Log(F("macro: saved"));
+}
+
+void FinishPlayback() {
+    CurrentMacroState = MacroIdle;
+    memset(MacroReport, 0, sizeof(MacroReport));
+    PlayReport(MacroReport);
+    Log(F("macro: played"));
+}
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+void LoadMacro() {
+    MacroHead = 0;
+    MacroLength = EEPROM.read(MacroSlot);
+    // erased or never saved
+    if (MacroLength > MacroBufferSize) MacroLength = 0;
+    for (uint8_t i = 0; i < MacroLength; i++) {
+        MacroBuffer[i] = EEPROM.read(MacroSlot + 1 + i);
+    }
+}
+
+// called by the macro keymap actions
+void RunMacroCommand(MacroCommand command, uint8_t key) {
+    if (key == MacroCommandKey) return;
+    MacroCommandKey = key;
+
+    switch (command) {
+        case RecordMacroCommand:
+            if (CurrentMacroState == MacroRecording) StopRecording();
+            // the recording being saved must stay as it is
+            else if (CurrentMacroState == MacroIdle && !SavingMacro) StartRecording();
+            break;
+        case PlayMacroCommand:
+            if (CurrentMacroState != MacroIdle || !MacroLength) return;
+            CurrentMacroState = MacroWaitingToPlay;
+            break;
+        case SaveMacroCommand:
+            if (CurrentMacroState == MacroIdle && !SavingMacro) SaveMacro();
+            break;
+    }
+}
+
+// Called after buf has been sent to the host. A few comparisons when recording, one otherwise.
+void RecordMacroReport(uint8_t buf[8]) {
+    if (CurrentMacroState != MacroRecording) return;
+
+    for (uint8_t i = 2; i < 8; i++) {
+        if (MacroReport[i] && !IsKeyPressedInBuffer(MacroReport[i], buf))
+            AppendMacroEvent(MacroReleaseEvent | MacroReport[i], 0, 1);
+    }
+    if (buf[0] != MacroReport[0]) AppendMacroEvent(MacroModsEvent, buf[0], 2);
+    for (uint8_t i = 2; i < 8; i++) {
+        // keys from MacroReleaseEvent up can't be told apart from releases; none are typed
+        if (buf[i] && buf[i] < MacroReleaseEvent && !IsKeyPressedInBuffer(buf[i], MacroReport))
+            AppendMacroEvent(buf[i], 0, 1);
+    }
+    CopyBuf(buf, MacroReport);
+}
+
+bool MacroPlaying() {
+    return CurrentMacroState == MacroWaitingToPlay || CurrentMacroState == MacroPlayingBack;
+}
+
+bool IsSavingMacro() {
+    return SavingMacro;
+}
+
+// called from loop()
+void MacroTask() {
+    if (MacroCommandKey && !IsKeyPressedInBuffer(MacroCommandKey, InputBuffer)) MacroCommandKey = 0;
+    if (SavingMacro && eeprom_is_ready()) WriteNextMacroByte();
+
+    if (CurrentMacroState == MacroWaitingToPlay) {
+        if (NumKeysOrModsPressed(InputBuffer) || ReportQueueDepth()) return;
+        memset(MacroReport, 0, sizeof(MacroReport));
+        MacroPlayOffset = 0;
+        CurrentMacroState = MacroPlayingBack;
+        Log(F("macro: playing"));
+    }
+    if (CurrentMacroState != MacroPlayingBack) return;
+
+    if (NumKeysOrModsPressed(InputBuffer)) {
+        // the keys pressed have already replaced the macro's on the host
+        CurrentMacroState = MacroIdle;
+        Log(F("macro: cancelled"));
+        return;
+    }
+    // one change per report, and per frame
+    if (ReportQueueDepth()) return;
+    if (MacroPlayOffset >= MacroLength) {
+        FinishPlayback();
+        return;
+    }
+    MacroPlayOffset += ApplyMacroEvent(MacroPlayOffset, MacroReport);
+    PlayReport(MacroReport);
+}
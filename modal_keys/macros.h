@@ -0,0 +1,40 @@
+#if !defined(__MACROS_H_)
+#define __MACROS_H_
+
+#include <Arduino.h>
+#include "eeprom_layout.h"
+
+// Dynamic macros: Escape+R starts recording the output reports sent to the host and Escape+R
+// again stops it, Escape+P plays the recording back and Escape+S saves it to EEPROM, a byte per
+// MacroTask run, from where it is loaded on startup.
+//
+// Reports are recorded after they have been sent, so recording doesn't delay them. Each one is
+// stored as its difference to the previous one, in the order TransitionToState sends them:
+//  - 0x80 | key: key released
+//  - 0x00, mods: the modifiers changed to mods
+//  - key: key pressed
+// The recording is a ring buffer: when it is full, the oldest changes make room for new ones.
+// Playback starts once all keys are released, sends one change per report through the report
+// queue from MacroTask, and is cancelled by pressing a key.
+
+#define MacroModsEvent 0x00
+#define MacroReleaseEvent 0x80
+
+// bytes of recording; the EEPROM slot also holds the length
+#define MacroBufferSize (MacroSlotSize - 1)
+
+// what the macro keys do
+typedef enum {
+    RecordMacroCommand = 0,     // start or stop recording
+    PlayMacroCommand,
+    SaveMacroCommand
+} MacroCommand;
+
+extern void LoadMacro();
+extern void RunMacroCommand(MacroCommand command, uint8_t key);
+extern void RecordMacroReport(uint8_t buf[8]);
+extern bool MacroPlaying();
+extern bool IsSavingMacro();
+extern void MacroTask();
+
+#endif // __MACROS_H_
@@ -3,9 +3,26 @@
 
 #include "keys.h"
 
+extern bool WriteToLog;
+extern uint8_t InputBuffer[8];
+
 extern String RichKeyToString(RichKey key);
 extern String BufferToString(uint8_t buf[8]);
 extern void Log(String text);
+extern void Log(const __FlashStringHelper *text);
+extern void Log(const __FlashStringHelper *prefix, const String &text);
 extern void PressAndReleaseKey(RichKey key);
+extern void PlayReport(uint8_t buf[8]);
+extern void QueueInputReport(uint8_t buf[8]);
+extern void ProcessInputReports();
+extern void ResetInput();
+extern void ParseReport(uint8_t buf[8], uint8_t prevbuf[8]);
+extern void ProcessReport(uint8_t buf[8]);
+extern void DrainLog();
+extern bool LogPending();
+// provided by the platform: the sketch or the Linux daemon
+extern void PollUsb();
+extern void SendKeysToHost(uint8_t buf[8]);
+extern bool HostReady();
 
 #endif // __MODAL_KEYS_H_
@@ -1,8 +1,12 @@
 #define LEONARDO
 
 #include "modal_keys.h"
+#include "boot_timeline.h"
 #include "keymap.h"
-#include "helpers.h"
+#include "commands.h"
+#include "leds.h"
+#include "scheduler.h"
+#include "usb_watchdog.h"
 
 #include <SoftwareSerial.h>
 #include <USBAPI.h>
@@ -26,19 +30,23 @@ protected:
     virtual void Parse(HID *hid, bool is_rpt_id, uint8_t len, uint8_t buf[8]);
 };
 
+// the stages of the LED report's control transfer
+typedef enum {
+    LedSetupStage = 0,
+    LedDataStage,
+    LedStatusStage
+} LedTransferStage;
+
 // *******************************************************************************************
 // Variables
 // *******************************************************************************************
 
-bool WriteToLog = true;
-bool SendOutput = true;
-
 USB Usb;
 HIDBoot<HID_PROTOCOL_KEYBOARD> HidKeyboard(&Usb);
 KbdRptParser Prs;
 
-uint8_t InputBuffer[8] = { 0 };
-uint8_t OutputBuffer[8] = { 0 };
+// the stage SetKeyboardLeds does next
+uint8_t LedStage = LedSetupStage;
 
 // *******************************************************************************************
 // Parse
@@ -48,183 +56,132 @@ void KbdRptParser::Parse(HID *hid, bool is_rpt_id, uint8_t len, uint8_t buf[8])
     // On error - return
     if (buf[2] == 1) return;
 
-    uint8_t outbuf[8] = { 0 };
-    TransformBuffer(buf, outbuf);
-
-    CopyBuf(buf, prevState.bInfo);
-    CopyBuf(buf, InputBuffer);
-    TransitionToState(outbuf);
+    QueueInputReport(buf);
 };
 
-// *******************************************************************************************
-// Helper Functions
-// *******************************************************************************************
-
-// returns true if a new state was transmitted
-bool TransitionToState(uint8_t newbuf[8]) {
-    if (EqualBuffers(newbuf, OutputBuffer)) { // no need to run transition if states are already equal
-        PrintState(InputBuffer, OutputBuffer, false);
-        return false;
-    }
-
-    uint8_t oldbuf[8] = { 0 };
-    CopyBuf(OutputBuffer, oldbuf);
-
-    // do released keys
-    uint8_t releaseKeys[8] = { 0 };
-    if (KeyIntersection(oldbuf, newbuf, releaseKeys)){
-        releaseKeys[0] = oldbuf[0];
-        SendState(releaseKeys);
-    }
-
-    // do released mods
-    uint8_t releaseMods[8] = { 0 };
-    if (ModIntersection(oldbuf, newbuf, releaseMods)){
-        CopyKeys(releaseKeys, releaseMods);
-        SendState(releaseMods);
-    }
-
-    // do pressed mods
-    uint8_t pressMods[8] = { 0 };
-    if (newbuf[0] != releaseMods[0]){
-        pressMods[0] = newbuf[0];
-        CopyKeys(releaseKeys, pressMods);
-        SendState(pressMods);
-    }
-
-    // do pressed keys
-    if (!EqualKeys(newbuf, releaseKeys)){
-        SendState(newbuf);
-    }
-    return true;
-}
-
-void SendState(uint8_t buf[8]) {
-    CopyBuf(buf, OutputBuffer);
-    PrintState(InputBuffer, OutputBuffer, true);
-    if (SendOutput){
-        delay(1);
-        SendKeysToHost(OutputBuffer);
-    }
+/* shared */ void PollUsb()
+{
+    Usb.Task();
 }
 
-
-
-// ****************************************************************************
-// Logging
-// ****************************************************************************
-
-String KeyToHexString(uint8_t key) {
-  int num_nibbles = 2;
-  String out = "";
-  do {
-          char v = 48 + (((key >> (num_nibbles - 1) * 4)) & 0x0f);
-          if(v > 57) v += 7;
-          out += v;
-  } while(--num_nibbles);
-  return out;
+/* shared */ void SendKeysToHost (uint8_t buf[8])
+{
+#ifdef LEONARDO
+    HID_SendReport(2,buf,8);
+#else
+    WriteOutputReportFrame(buf);
+#endif
 }
 
-String ModifiersToString(uint8_t mods) {
-    MODIFIERKEYS mod;
-    *((uint8_t*)&mod) = mods;
-    String str = "<" +
-    String((mod.bmLeftCtrl   == 1) ? "C" : "-") +
-    String((mod.bmLeftShift  == 1) ? "S" : "-") +
-    String((mod.bmLeftAlt    == 1) ? "A" : "-") +
-    String((mod.bmLeftGUI    == 1) ? "G" : "-") +
-    "." +
-    String((mod.bmRightCtrl   == 1) ? "C" : "-") +
-    String((mod.bmRightShift  == 1) ? "S" : "-") +
-    String((mod.bmRightAlt    == 1) ? "A" : "-") +
-    String((mod.bmRightGUI    == 1) ? "G" : "-") +
-    ">";
-    return str;
+// One transaction on the keyboard's endpoint 0. It is waited for, as Usb.Task() mustn't start one
+// of its own meanwhile, but a NAK ends it: that takes well under a frame.
+uint8_t LedTransaction(uint8_t token)
+{
+    Usb.regWr(rHXFR, token);
+    while (!(Usb.regRd(rHIRQ) & bmHXFRDNIRQ));
+    Usb.regWr(rHIRQ, bmHXFRDNIRQ);
+    return Usb.regRd(rHRSL) & 0x0F;
 }
 
-String KeyToString(uint8_t key) {
-    if (key) {
-        return KeyToHexString(key);
-    } else {
-        return "__";
+// The core doesn't pass the host's LED reports on, so on the Leonardo the keyboard shows the
+// engine's state only; without LEONARDO, linux/serial_receiver sends them with SetHostLedsCommand.
+// The boot protocol's LED output report goes out with a SET_REPORT control transfer, a stage per
+// call: HidKeyboard.SetReport() would retry a NAK for as long as the keyboard sends them.
+/* shared */ KeyboardLedsProgress SetKeyboardLeds(uint8_t leds)
+{
+    if (!HidKeyboard.isReady()) {
+        LedStage = LedSetupStage;
+        return KeyboardLedsFailed;
     }
-}
-
-/* shared */ String RichKeyToString(RichKey key) {
-    String modStr = ModifiersToString(key.mods);
-    String keyStr = KeyToString(key.key);
-    return modStr + keyStr;
-}
-
-/* shared */ void Log(String text){
-    if (!WriteToLog) return;
-    Serial.println(text);
-}
-
-String BufferToString(uint8_t buf[8]) {
-    String out = "";
-    out += ModifiersToString(buf[0]);
-    out += ModifiersToString(buf[1]);
-    for (uint8_t i = 2; i < 8; i++) {
-        out += (" " + KeyToString(buf[i]));
+    // rMODE is left as the keyboard's by the polls of HidKeyboard, the only device
+    Usb.regWr(rPERADDR, HidKeyboard.GetAddress());
+    uint8_t result;
+    switch (LedStage) {
+        case LedSetupStage: {
+            // SET_REPORT to the interface: output report 0 of one byte
+            uint8_t setup[8] = { 0x21, 0x09, 0x00, 0x02, 0x00, 0x00, 0x01, 0x00 };
+            Usb.bytesWr(rSUDFIFO, 8, setup);
+            result = LedTransaction(tokSETUP);
+            break;
+        }
+        case LedDataStage:
+            Usb.regWr(rHCTL, bmSNDTOG1);
+            Usb.bytesWr(rSNDFIFO, 1, &leds);
+            Usb.regWr(rSNDBC, 1);
+            result = LedTransaction(tokOUT);
+            break;
+        default:
+            Usb.regWr(rHCTL, bmRCVTOG1);
+            result = LedTransaction(tokINHS);
+            break;
     }
-    return out;
-}
-
-void PrintState(uint8_t inBuf[8], uint8_t outBuf[8], bool outputChanged) {
-    if (!WriteToLog) return;
-    Serial.print(GetStateString());
-    Serial.print(BufferToString(inBuf));
-    if (outputChanged){
-        Serial.print("  ==>  ");
-        Serial.print(BufferToString(outBuf));
+    if (result == hrNAK) return KeyboardLedsPending;
+    if (result != hrSUCCESS) {
+        LedStage = LedSetupStage;
+        return KeyboardLedsFailed;
     }
-    Serial.println();
+    if (LedStage != LedStatusStage) {
+        LedStage++;
+        return KeyboardLedsPending;
+    }
+    LedStage = LedSetupStage;
+    return KeyboardLedsSent;
 }
 
-void PressKey(RichKey key){
-    uint8_t buf[8];
-    CopyBuf(OutputBuffer, buf);
-    MergeKeyIntoBuffer(key, buf, true);
-    TransitionToState(buf);
+// the computer has configured the Arduino as a keyboard; reports sent before are lost
+/* shared */ bool HostReady()
+{
+#ifdef LEONARDO
+    return USBDevice.configured();
+#else
+    return true;
+#endif
 }
 
-/* shared */ void PressAndReleaseKey(RichKey key){
-    uint8_t current_buf[8];
-    CopyBuf(OutputBuffer, current_buf);
-
-    PressKey(key);
-    TransitionToState(current_buf);
+/* shared */ UsbHostState GetUsbHostState()
+{
+    // the MAX3421E comes out of a reset in peripheral mode
+    if (!(Usb.regRd(rMODE) & bmHOST)) return UsbHostControllerReset;
+
+    uint8_t state = Usb.getUsbTaskState();
+    if (state == USB_STATE_RUNNING) return HidKeyboard.isReady() ? UsbHostRunning : UsbHostFault;
+    if (state == USB_STATE_ERROR) return UsbHostFault;
+    if ((state & USB_STATE_MASK) == USB_STATE_DETACHED) return UsbHostNoDevice;
+    return UsbHostEnumerating;
 }
 
-inline void SendKeysToHost (uint8_t buf[8])
+/* shared */ void RestartUsbHost(bool resetController)
 {
-#ifdef LEONARDO
-    HID_SendReport(2,buf,8);
-#else
-    Serial.write(buf, 8);
-#endif
+    // either way the library releases the keyboard and enumerates it again; the parser stays
+    if (resetController) Usb.Init();
+    else Usb.setUsbTaskState(USB_DETACHED_SUBSTATE_INITIALIZE);
 }
 
 // *******************************************************************************************
 // Arduino main functions
 // *******************************************************************************************
 
+// The keyboard's enumeration takes longest, so it starts first and goes on while the
+// configuration loads. Nothing waits here: the USB host library takes its own time, and
+// reports wait for the computer (see boot_timeline.h).
 void setup()
 {
-    InitializeState();
-
+    NoteBootStage(SetupStartedStage);
     Serial.begin( 115200 );
 
+    HidKeyboard.SetReportParser(0, (HIDReportParser*)&Prs);
+    // the watchdog resets a host controller that didn't start
     if (Usb.Init() == -1 && WriteToLog)
         Serial.println("OSC did not start.");
+    NoteBootStage(UsbHostStartedStage);
 
-    delay( 200 );
-
-    HidKeyboard.SetReportParser(0, (HIDReportParser*)&Prs);
+    InitializeState();
+    NoteBootStage(StateLoadedStage);
+    InitializeCommands();
+    NoteBootStage(SetupDoneStage);
 }
 
 void loop()
 {
-    Usb.Task();
+    RunTasks();
 }
@@ -0,0 +1,117 @@
+#include "modal_keys.h"
+#include "oneshot.h"
+#include "helpers.h"
+#include "transform_cache.h"
+#include "tuning.h"
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+// mods of the trigger keys mapped in the report being transformed, and in the previous report
+uint8_t OneShotTriggers = 0;
+uint8_t HeldTriggers = 0;
+// something was typed while the held triggers were down, so they were used as ordinary modifiers
+bool HeldTriggersUsed = false;
+
+// applied to the next key pressed, then cleared
+uint8_t ArmedMods = 0;
+uint32_t ArmedSince = 0;
+// applied to every report with keys, until tapped again
+uint8_t LockedMods = 0;
+
+// ****************************************************************************
+// Helper Functions
+// ****************************************************************************
+
+bool PressesNewKey(uint8_t buf[8], uint8_t prevbuf[8]) {
+    for (uint8_t i = 2; i < 8; i++) {
+        if (buf[i] && !IsKeyPressedInBuffer(buf[i], prevbuf)) return true;
+    }
+    return false;
+}
+
+String OneShotString(uint8_t mods) {
+    return RichKeyToString((RichKey){ mods, 0 });
+}
+
+// trigger keys for mods were pressed and released with nothing typed in between
+void TapOneShot(uint8_t mods) {
+    if ((LockedMods & mods) == mods) {
+        LockedMods &= ~mods;
+        Log(F("one-shot unlocked: "), OneShotString(mods));
+    } else if ((ArmedMods & mods) == mods) {
+        // tapped twice within the timeout
+        ArmedMods &= ~mods;
+        LockedMods |= mods;
+        Log(F("one-shot locked: "), OneShotString(mods));
+    } else {
+        ArmedMods |= mods;
+        ArmedSince = millis();
+        Log(F("one-shot armed: "), OneShotString(ArmedMods));
+    }
+}
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+// called by SendOneShotModifiers while a trigger key is mapped
+void NoteOneShotTrigger(uint8_t mods) {
+    OneShotTriggers |= mods;
+    // the tap bookkeeping isn't part of outbuf
+    NoteTransformSideEffect();
+}
+
+// Called before each transformation. The modifiers to start the transformation of inbuf with:
+// the armed ones if it presses a new key, and the locked ones if it has any keys.
+uint8_t OneShotModifiersFor(uint8_t inbuf[8], uint8_t previnbuf[8]) {
+    // only triggers mapped since here count, not e.g. those of a keymap benchmark
+    OneShotTriggers = 0;
+    if (!(ArmedMods | LockedMods) || !inbuf[2]) return 0;
+    return LockedMods | (PressesNewKey(inbuf, previnbuf) ? ArmedMods : 0);
+}
+
+// After a transformation that started with the applied modifiers and produced outbuf, with
+// hostbuf the last report sent. Takes the modifiers out again if no key got them (so e.g. Alt
+// alone never reaches the host), and clears the armed ones once they have been used.
+void UpdateOneShotModifiers(uint8_t applied, uint8_t outbuf[8], uint8_t hostbuf[8]) {
+    if (applied) {
+        uint8_t keep = 0;
+        if (outbuf[2]) keep |= LockedMods;
+        if (PressesNewKey(outbuf, hostbuf) && (applied & ArmedMods)) {
+            keep |= ArmedMods;
+            Log(F("one-shot used: "), OneShotString(ArmedMods));
+            ArmedMods = 0;
+        }
+        outbuf[0] &= ~(applied & ~keep);
+        outbuf[1] &= ~(applied & ~keep);
+    }
+
+    if (OneShotTriggers && outbuf[2]) HeldTriggersUsed = true;
+    uint8_t released = HeldTriggers & ~OneShotTriggers;
+    if (released && !HeldTriggersUsed && !outbuf[2]) TapOneShot(released);
+    HeldTriggers = OneShotTriggers;
+    if (!HeldTriggers) HeldTriggersUsed = false;
+    OneShotTriggers = 0;
+}
+
+// called from loop(): armed modifiers that haven't been used within OneShotTimeoutTuning expire
+void OneShotTask() {
+    if (!ArmedMods || !Tunings[OneShotTimeoutTuning]) return;
+    if (millis() - ArmedSince < Tunings[OneShotTimeoutTuning]) return;
+    Log(F("one-shot timed out: "), OneShotString(ArmedMods));
+    ArmedMods = 0;
+}
+
+bool OneShotsPending() {
+    return ArmedMods != 0;
+}
+
+void ResetOneShotModifiers() {
+    OneShotTriggers = 0;
+    HeldTriggers = 0;
+    HeldTriggersUsed = false;
+    ArmedMods = 0;
+    LockedMods = 0;
+}
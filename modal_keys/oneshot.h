@@ -0,0 +1,21 @@
+#if !defined(__ONESHOT_H_)
+#define __ONESHOT_H_
+
+#include <Arduino.h>
+
+// One-shot modifiers: a key mapped with SendOneShotModifiers acts as a held modifier as usual,
+// but tapped on its own it arms its modifiers for the next key pressed, in whatever mode, so
+// Alt+Q then A types a capital A without holding three keys. Tapping it again before the
+// armed modifiers are used or time out (OneShotTimeoutTuning) locks them until a third tap.
+//
+// The engine asks OneShotModifiersFor() whether a report gets them, and reports the
+// outcome with UpdateOneShotModifiers(); both are a few comparisons per report.
+
+extern void NoteOneShotTrigger(uint8_t mods);
+extern uint8_t OneShotModifiersFor(uint8_t inbuf[8], uint8_t previnbuf[8]);
+extern void UpdateOneShotModifiers(uint8_t applied, uint8_t outbuf[8], uint8_t hostbuf[8]);
+extern void OneShotTask();
+extern bool OneShotsPending();
+extern void ResetOneShotModifiers();
+
+#endif // __ONESHOT_H_
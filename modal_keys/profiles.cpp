@@ -0,0 +1,77 @@
+#include "modal_keys.h"
+#include "profiles.h"
+#include "keymap.h"
+#include "helpers.h"
+#include "oneshot.h"
+
+// ****************************************************************************
+// Constants
+// ****************************************************************************
+
+// by index: F1.. with Escape, 1.. with RightCtrl
+const Profile Profiles[] PROGMEM = {
+    { KeepOSMode,   qwerty, NormalNoKeysMode,       { } },
+    { KeepOSMode,   dvorak, ModalNoKeysMode,        { } },
+    // combos and home-row modifiers would hold back keys that are often pressed together in games
+    { KeepOSMode,   qwerty, GamingNoKeysMode,       { TuningOverride(ComboWindowTuning, 0), TuningOverride(HomeRowHoldTuning, 0) } },
+    { KeepOSMode,   qwerty, BlackDesertNoKeysMode,  { TuningOverride(ComboWindowTuning, 0), TuningOverride(HomeRowHoldTuning, 0) } },
+};
+
+#define NumProfileEntries (sizeof(Profiles) / sizeof(Profile))
+
+static_assert(MaxTuningOverrides <= NumTunings, "a profile has more tuning overrides than there are tunings");
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+uint8_t CurrentProfile = NoProfile;
+
+// keys and modifiers held when the profile changed; they stay hidden from the mode engine until released
+uint8_t ProfileHeldKeys[8] = { 0 };
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+uint8_t NumProfiles() {
+    return NumProfileEntries;
+}
+
+bool ActivateProfile(uint8_t index) {
+    if (index >= NumProfileEntries) return false;
+    Profile profile;
+    memcpy_P(&profile, &Profiles[index], sizeof(Profile));
+
+    // the overrides apply on top of the stored tunings, not those of the previous profile
+    LoadTunings();
+    for (uint8_t i = 0; i < MaxTuningOverrides; i++) {
+        uint8_t id = profile.tunings[i].tuning - 1;
+        if (id < NumTunings) Tunings[id] = profile.tunings[i].value;
+    }
+    if (profile.osMode != KeepOSMode && profile.osMode != CurrentOSMode)
+        SetOSMode((OSMode)profile.osMode);
+    SetConfiguration((KeyboardLayout)profile.layout, (Mode)profile.entryPointMode);
+
+    ResetOneShotModifiers();
+    CopyBuf(InputBuffer, ProfileHeldKeys);
+    CurrentProfile = index;
+    Log(F("profile "), String(index));
+    return true;
+}
+
+// hide the keys held since the last profile change, forgetting those that have been released
+void MaskProfileHeldKeys(uint8_t buf[8]) {
+    if (NumKeysOrModsPressed(ProfileHeldKeys) == 0) return;
+
+    ProfileHeldKeys[0] &= buf[0];
+    buf[0] &= ~ProfileHeldKeys[0];
+    for (uint8_t i = 2; i < 8; i++) {
+        if (ProfileHeldKeys[i] && !IsKeyPressedInBuffer(ProfileHeldKeys[i], buf)) ProfileHeldKeys[i] = 0;
+    }
+    uint8_t n = 2;
+    for (uint8_t i = 2; i < 8; i++) {
+        if (buf[i] && !IsKeyPressedInBuffer(buf[i], ProfileHeldKeys)) buf[n++] = buf[i];
+    }
+    while (n < 8) buf[n++] = 0;
+}
@@ -0,0 +1,41 @@
+#if !defined(__PROFILES_H_)
+#define __PROFILES_H_
+
+#include <Arduino.h>
+#include "tuning.h"
+
+// Profiles: complete configurations kept in flash, switched to with Escape+F1.., RightCtrl+1..
+// or ActivateProfileCommand. Switching only copies one table entry, and keys held at the time
+// are hidden from the mode engine until they are released, so they can't get stuck or change
+// meaning half way through a press.
+
+// leaves the OS mode as it is
+#define KeepOSMode 0xFF
+
+// Tuning overrides are (id, value) pairs rather than a value for every tuning, so appending a
+// tuning leaves the profiles as they were. The id is kept off by one: the entries a profile
+// leaves out are zero, and override nothing.
+#define MaxTuningOverrides 3
+#define TuningOverride(id, value) { (id) + 1, (value) }
+
+struct TuningOverrideEntry {
+    uint8_t tuning;     // TuningId + 1, or 0
+    uint16_t value;
+};
+
+struct Profile {
+    uint8_t osMode;                 // OSMode or KeepOSMode
+    uint8_t layout;                 // KeyboardLayout
+    uint8_t entryPointMode;         // Mode
+    TuningOverrideEntry tunings[MaxTuningOverrides];    // on top of the stored tunings
+};
+
+#define NoProfile 0xFF
+
+extern uint8_t CurrentProfile;
+
+extern uint8_t NumProfiles();
+extern bool ActivateProfile(uint8_t index);
+extern void MaskProfileHeldKeys(uint8_t buf[8]);
+
+#endif // __PROFILES_H_
@@ -0,0 +1,181 @@
+#include "modal_keys.h"
+#include "report_queue.h"
+#include "helpers.h"
+#include "boot_timeline.h"
+#include "macros.h"
+#include "stats.h"
+
+// the USB controller's frame number register, which advances on every start-of-frame
+#if defined(UDFNUML)
+#define HAS_USB_FRAME_NUMBER
+#endif
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+uint8_t ReportQueue[ReportQueueSize][8];
+uint32_t ReportQueuedMicros[ReportQueueSize];
+uint8_t ReportQueueHead = 0;
+uint8_t ReportQueueCount = 0;
+
+// the state the host currently has
+uint8_t LastSentReport[8] = { 0 };
+uint32_t LastSentMicros = 0;
+
+#ifdef HAS_USB_FRAME_NUMBER
+uint16_t LastFrameNumber = 0;
+// last time the frame number was seen unchanged: a new frame started after this
+uint32_t LastFramePollMicros = 0;
+// when the frame number was last seen to change
+uint32_t LastFrameMicros = 0;
+#endif
+
+// ****************************************************************************
+// Helper Functions
+// ****************************************************************************
+
+uint8_t QueueSlot(uint8_t index) {
+    return (ReportQueueHead + index) % ReportQueueSize;
+}
+
+uint8_t *QueuedReport(uint8_t index) {
+    return ReportQueue[QueueSlot(index)];
+}
+
+uint8_t NumKeysPressedBetween(uint8_t from[8], uint8_t to[8]) {
+    uint8_t count = 0;
+    for (uint8_t i = 2; i < 8; i++) {
+        if (to[i] && !IsKeyPressedInBuffer(to[i], from)) count++;
+    }
+    return count;
+}
+
+// true if a key changes state twice across the three reports
+bool KeyPulses(uint8_t before[8], uint8_t middle[8], uint8_t after[8]) {
+    // pressed only in the middle: a whole key press would be lost
+    for (uint8_t i = 2; i < 8; i++) if (middle[i]) {
+        if (!IsKeyPressedInBuffer(middle[i], before) && !IsKeyPressedInBuffer(middle[i], after)) return true;
+    }
+    // released only in the middle: a release and re-press would be lost
+    for (uint8_t i = 2; i < 8; i++) if (before[i]) {
+        if (IsKeyPressedInBuffer(before[i], after) && !IsKeyPressedInBuffer(before[i], middle)) return true;
+    }
+    return false;
+}
+
+// The queued `middle` report can be dropped when going straight from `before` to `after` shows
+// the host every edge it would have seen anyway, in an order that can't change its meaning:
+//  - no key or modifier goes down and up again (or up and down) within the three reports
+//  - at most one key is pressed, so presses are never reordered by the host
+//  - a key press never shares a report with a modifier change, which is the ordering
+//    TransitionToState works to guarantee
+bool CanCoalesce(uint8_t before[8], uint8_t middle[8], uint8_t after[8]) {
+    uint8_t modPulses = (before[0] ^ middle[0]) & ~(before[0] ^ after[0]);
+    if (modPulses || KeyPulses(before, middle, after)) return false;
+
+    uint8_t pressed = NumKeysPressedBetween(before, after);
+    if (pressed > 1) return false;
+    if (pressed == 1 && before[0] != after[0]) return false;
+    return true;
+}
+
+void SendReport(uint8_t buf[8]) {
+    NoteBootStage(FirstOutputStage);
+    SendKeysToHost(buf);
+    CopyBuf(buf, LastSentReport);
+    LastSentMicros = micros();
+    CountStat(OutputReportsStat);
+    RecordMacroReport(buf);
+}
+
+void SendOldestReport() {
+    uint32_t waited = micros() - ReportQueuedMicros[QueueSlot(0)];
+    if (waited > Stats[MaxReportWaitMicrosStat]) Stats[MaxReportWaitMicrosStat] = waited;
+    SendReport(QueuedReport(0));
+    ReportQueueHead = (ReportQueueHead + 1) % ReportQueueSize;
+    ReportQueueCount--;
+}
+
+#ifdef HAS_USB_FRAME_NUMBER
+uint16_t UsbFrameNumber() {
+    uint8_t low, high;
+    do {
+        low = UDFNUML;
+        high = UDFNUMH;
+    } while (low != UDFNUML);
+    return ((uint16_t)(high & 0x07) << 8) | low;
+}
+#endif
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+// Queue a report for the host, first dropping queued reports that `buf` supersedes.
+void QueueReport(uint8_t buf[8]) {
+    // a report that replaces queued ones carries their edges, so it has been waiting as long as they have
+    uint32_t queuedMicros = micros();
+    while (ReportQueueCount) {
+        uint8_t *tail = QueuedReport(ReportQueueCount - 1);
+        uint8_t *before = (ReportQueueCount > 1) ? QueuedReport(ReportQueueCount - 2) : LastSentReport;
+        if (!CanCoalesce(before, tail, buf)) break;
+        ReportQueueCount--;
+        queuedMicros = ReportQueuedMicros[QueueSlot(ReportQueueCount)];
+        CountStat(CoalescedReportsStat);
+    }
+
+    if (ReportQueueCount == ReportQueueSize) {
+        // never lose an edge: make room by sending the oldest report right away
+        CountStat(ReportQueueOverflowsStat);
+        SendOldestReport();
+    }
+
+    CopyBuf(buf, QueuedReport(ReportQueueCount));
+    ReportQueuedMicros[QueueSlot(ReportQueueCount)] = queuedMicros;
+    ReportQueueCount++;
+    if (ReportQueueCount > Stats[MaxReportQueueDepthStat])
+        Stats[MaxReportQueueDepthStat] = ReportQueueCount;
+}
+
+// Called from loop(): sends the oldest queued report once per frame, once the host is there.
+void DrainReportQueue() {
+    if (WaitingForHost()) return;
+#ifdef HAS_USB_FRAME_NUMBER
+    uint32_t now = micros();
+    uint16_t frame = UsbFrameNumber();
+    if (frame == LastFrameNumber) {
+        LastFramePollMicros = now;
+        // no frames: don't hold on to reports forever
+        if (ReportQueueCount && now - LastFrameMicros >= MaxMicrosWithoutFrame && now - LastSentMicros >= MicrosPerFrame)
+            SendOldestReport();
+        return;
+    }
+    // the start-of-frame happened between the last poll and now, so this bounds how
+    // late in the frame the report goes out
+    uint32_t frameOffset = now - LastFramePollMicros;
+    LastFrameNumber = frame;
+    LastFramePollMicros = now;
+    LastFrameMicros = now;
+    if (!ReportQueueCount) return;
+
+    SendOldestReport();
+    CountStat(FrameAlignedReportsStat);
+    Stats[FrameOffsetTotalMicrosStat] += frameOffset;
+    if (frameOffset > Stats[FrameOffsetMaxMicrosStat]) Stats[FrameOffsetMaxMicrosStat] = frameOffset;
+#else
+    if (!ReportQueueCount || micros() - LastSentMicros < MicrosPerFrame) return;
+    SendOldestReport();
+#endif
+}
+
+uint8_t ReportQueueDepth() {
+    return ReportQueueCount;
+}
+
+// Drop the queued reports and send an empty one straight away, without waiting for a frame.
+void ReleaseAllKeysNow() {
+    ReportQueueCount = 0;
+    uint8_t released[8] = { 0 };
+    SendReport(released);
+}
@@ -0,0 +1,20 @@
+#if !defined(__REPORT_QUEUE_H_)
+#define __REPORT_QUEUE_H_
+
+#include <Arduino.h>
+
+// Output reports waiting to be sent to the host, one per USB frame (1 ms).
+// On boards with native USB (the Leonardo's ATmega32U4) reports are sent right after the
+// device sees a start-of-frame, so they are ready for the host's next poll.
+#define ReportQueueSize 8
+#define MicrosPerFrame 1000
+
+// send anyway if no start-of-frame shows up for this long (e.g. the host suspended the bus)
+#define MaxMicrosWithoutFrame 3000
+
+extern void QueueReport(uint8_t buf[8]);
+extern void DrainReportQueue();
+extern uint8_t ReportQueueDepth();
+extern void ReleaseAllKeysNow();
+
+#endif // __REPORT_QUEUE_H_
@@ -0,0 +1,123 @@
+#include "modal_keys.h"
+#include "scheduler.h"
+#include "combos.h"
+#include "commands.h"
+#include "home_row.h"
+#include "keymap.h"
+#include "keymap_vm.h"
+#include "leds.h"
+#include "leader.h"
+#include "macros.h"
+#include "oneshot.h"
+#include "report_queue.h"
+#include "typing.h"
+#include "usb_watchdog.h"
+#include "usage.h"
+
+// ****************************************************************************
+// Constants
+// ****************************************************************************
+
+struct Task {
+    void (*run)();
+    uint16_t deadlineMicros;    // longest the task should wait between runs; unused for the key path
+};
+
+const Task Tasks[NumTasks] PROGMEM = {
+    { &PollUsb,                 0 },
+    { &ProcessInputReports,     0 },
+    { &DrainReportQueue,        0 },
+    { &ComboTask,               1000 },
+    { &ProcessSerialCommands,   2000 },
+    { &DrainLog,                2000 },
+    { &UsageTask,               20000 },
+    { &OneShotTask,             10000 },
+    { &LeaderTask,              10000 },
+    { &MacroTask,               1000 },
+    { &TypingTask,              1000 },
+    { &HomeRowTask,             1000 },
+    { &LedTask,                 20000 },
+    { &UsbWatchdogTask,         5000 },
+    { &CustomKeymapTask,        5000 },
+    { &KeymapProgramTask,       5000 },
+};
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+uint32_t TaskStartedMicros[NumTasks] = { 0 };
+#if defined(TASK_STATS)
+uint32_t TaskRuns[NumTasks] = { 0 };
+uint32_t TaskTotalMicros[NumTasks] = { 0 };
+uint16_t TaskMaxMicros[NumTasks] = { 0 };
+uint16_t TaskLateRuns[NumTasks] = { 0 };
+#endif
+
+// ****************************************************************************
+// Helper Functions
+// ****************************************************************************
+
+void RunTask(uint8_t id, uint32_t start) {
+    TaskStartedMicros[id] = start;
+    ((void (*)())pgm_read_ptr(&Tasks[id].run))();
+#if defined(TASK_STATS)
+    uint32_t elapsed = micros() - start;
+    TaskRuns[id]++;
+    TaskTotalMicros[id] += elapsed;
+    if (elapsed > TaskMaxMicros[id]) TaskMaxMicros[id] = elapsed > 0xFFFF ? 0xFFFF : elapsed;
+#endif
+}
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+// called from loop()
+void RunTasks() {
+    for (uint8_t id = 0; id < NumKeyPathTasks; id++) {
+        RunTask(id, micros());
+    }
+
+    uint32_t now = micros();
+    uint8_t next = NumKeyPathTasks;
+    int32_t nextSlack = 0x7FFFFFFF;
+    for (uint8_t id = NumKeyPathTasks; id < NumTasks; id++) {
+        int32_t slack = (int32_t)(TaskStartedMicros[id] + pgm_read_word(&Tasks[id].deadlineMicros) - now);
+        if (slack < nextSlack) {
+            next = id;
+            nextSlack = slack;
+        }
+    }
+#if defined(TASK_STATS)
+    if (nextSlack < 0 && TaskLateRuns[next] != 0xFFFF) TaskLateRuns[next]++;
+#endif
+    RunTask(next, now);
+}
+
+uint8_t NumTaskStats() {
+#if defined(TASK_STATS)
+    return NumTasks;
+#else
+    return 0;
+#endif
+}
+
+TaskStats GetTaskStats(uint8_t id) {
+#if defined(TASK_STATS)
+    return (TaskStats){ TaskRuns[id], TaskTotalMicros[id], TaskMaxMicros[id], TaskLateRuns[id] };
+#else
+    return (TaskStats){ 0, 0, 0, 0 };
+#endif
+}
+
+void ResetTaskStats() {
+#if defined(TASK_STATS)
+    for (uint8_t id = 0; id < NumTasks; id++) {
+        TaskRuns[id] = 0;
+        TaskTotalMicros[id] = 0;
+        TaskMaxMicros[id] = 0;
+        TaskLateRuns[id] = 0;
+    }
+#endif
+}
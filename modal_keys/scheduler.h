@@ -0,0 +1,49 @@
+#if !defined(__SCHEDULER_H_)
+#define __SCHEDULER_H_
+
+#include <Arduino.h>
+
+// The work loop() does, as tasks in priority order. The key path (the first NumKeyPathTasks)
+// runs on every pass; after it, the one other task closest to or furthest past its deadline
+// runs, so background work holds up the next USB poll by at most one task.
+// Ids are part of the serial protocol: only ever append new ones.
+typedef enum {
+    UsbPollTask = 0,            // PollUsb(): the USB host shield, which delivers input reports
+    InputReportsTask,           // run received reports through the mode engine
+    ReportQueueTask,            // send queued output reports to the host
+    ComboTimerTask,             // combo window timeouts
+    SerialCommandsTask,         // parse and execute serial commands
+    LogOutputTask,              // write buffered log text to the serial port
+    UsageFlushTask,             // usage counters to EEPROM
+    OneShotTimerTask,           // one-shot modifier timeouts
+    LeaderTimerTask,            // leader sequence timeouts
+    MacroPlaybackTask,          // dynamic macro playback
+    TypingOutputTask,           // input sequences of characters being typed
+    HomeRowTimerTask,           // home-row modifier hold timeouts
+    KeyboardLedsTask,           // the keyboard's LEDs
+    UsbRecoveryTask,            // the watchdog of the keyboard's USB connection
+    CustomKeymapSaveTask,       // uploaded custom layout entries to EEPROM
+    KeymapProgramSaveTask,      // uploaded parts of the keymap program image to EEPROM
+    NumTasks
+} TaskId;
+
+#define NumKeyPathTasks 3
+
+// Building with TASK_STATS keeps the counts of GetTaskStats, 12 bytes of RAM a task that the
+// Leonardo can't spare next to the USB host library; the Linux daemon has it. Without it,
+// GetTaskStatsCommand reports no tasks.
+// #define TASK_STATS
+
+struct TaskStats {
+    uint32_t runs;
+    uint32_t totalMicros;
+    uint32_t maxMicros;
+    uint32_t lateRuns;          // runs that started after the task's deadline
+};
+
+extern void RunTasks();
+extern uint8_t NumTaskStats();
+extern TaskStats GetTaskStats(uint8_t id);
+extern void ResetTaskStats();
+
+#endif // __SCHEDULER_H_
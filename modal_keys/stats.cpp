@@ -0,0 +1,9 @@
+#include "stats.h"
+
+uint32_t Stats[NumStats] = { 0 };
+
+void ResetStats() {
+    for (uint8_t i = 0; i < NumStats; i++) {
+        Stats[i] = 0;
+    }
+}
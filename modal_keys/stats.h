@@ -0,0 +1,66 @@
+#if !defined(__STATS_H_)
+#define __STATS_H_
+
+#include <Arduino.h>
+
+// Counters that can be queried over the serial command interface.
+// Ids are part of the serial protocol: only ever append new ones.
+typedef enum {
+    InputReportsStat = 0,
+    OutputReportsStat,
+    CommandFramesStat,
+    CommandErrorsStat,
+    VmInstructionsStat,
+    VmMaxReportInstructionsStat,
+    VmBudgetExceededStat,
+    CombosFiredStat,
+    ComboKeysHeldStat,
+    ComboFlushesStat,
+    CoalescedReportsStat,
+    MaxReportQueueDepthStat,
+    ReportQueueOverflowsStat,
+    MaxReportWaitMicrosStat,        // longest time a report spent queued
+    FrameAlignedReportsStat,        // reports sent on a start-of-frame
+    FrameOffsetTotalMicrosStat,     // sum and max of the (upper bound on the) time from
+    FrameOffsetMaxMicrosStat,       // start-of-frame to sending, i.e. the timing jitter
+    TransformCacheHitsStat,
+    TransformCacheMissesStat,
+    TransformCacheUncachedStat,     // transformations with side effects or of empty reports
+    PassthroughReportsStat,         // reports forwarded unchanged by the gaming fast path
+    PassthroughTotalMicrosStat,     // sum and max of the time from receiving such a report
+    PassthroughMaxMicrosStat,       // to queueing its output
+    PassthroughOverTargetStat,      // ... that took longer than PassthroughTargetMicros
+    ShiftConflictsStat,             // transitions pressing keys that need different shifts
+    ShiftConflictReportsStat,       // reports sent to press the keys of those ahead of the rest
+    InputQueueOverflowsStat,        // reports merged into one because their edges didn't fit the input queue (see QueueInputReport)
+    LogLinesDroppedStat,            // log lines that didn't fit the log buffer
+    TypedCharactersStat,            // characters typed with an input sequence (see typing.h)
+    TypingReportsStat,              // reports sent for them
+    TypingMicrosStat,               // time from the first report of each to the last
+    HomeRowTapsStat,                // home-row keys held back, then typed (see home_row.h)
+    HomeRowBurstTapsStat,           // home-row keys typed straight away, in a burst of typing
+    HomeRowHoldsStat,               // home-row keys that became modifiers
+    HomeRowDecisionTotalMillisStat, // sum and max of the time a home-row key was held back
+    HomeRowDecisionMaxMillisStat,
+    HomeRowUnusedHoldsStat,         // holds released without a key pressed with them
+    HomeRowCorrectionsStat,         // decisions followed by Backspace
+    KeyboardLedReportsStat,         // LED states sent to the keyboard (see leds.h)
+    KeyboardLedMaxMicrosStat,       // longest time sending one took, from the first task run to the last
+    UsbFaultsStat,                  // times the keyboard went away (see usb_watchdog.h)
+    UsbRestartsStat,                // enumerations and host controller resets restarted
+    UsbRecoveriesStat,              // times it came back, and the sum and max of the time that took
+    UsbRecoveryTotalMillisStat,
+    UsbRecoveryMaxMillisStat,
+    InputReportsHeldForHostStat,    // reports that arrived before the host was ready (see boot_timeline.h)
+    NumStats
+} StatId;
+
+extern uint32_t Stats[NumStats];
+
+inline void CountStat(StatId id) {
+    Stats[id]++;
+}
+
+extern void ResetStats();
+
+#endif // __STATS_H_
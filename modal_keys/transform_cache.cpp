@@ -0,0 +1,103 @@
+#include "transform_cache.h"
+#include "keymap.h"
+#include "helpers.h"
+#include "layers.h"
+#include "stats.h"
+#include "usage.h"
+
+#define EmptyEntry 0xFF
+
+// ****************************************************************************
+// Types
+// ****************************************************************************
+
+struct TransformCacheEntry {
+    uint8_t mode;           // CurrentMode before, or EmptyEntry
+    uint8_t state;          // see TransformState()
+    uint8_t inbuf[8];
+    uint8_t outbuf[8];
+    uint8_t nextMode;
+    uint8_t nextState;      // ModeState after
+    uint8_t enterModes;     // usage events counted by the transformation
+    uint8_t invalidKeys;
+};
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+TransformCacheEntry TransformCache[TransformCacheSize];
+bool TransformSideEffect = false;
+
+// ****************************************************************************
+// Helper Functions
+// ****************************************************************************
+
+// everything besides the report and the mode that the transformation depends on
+uint8_t TransformState() {
+    return CurrentModeState | (CurrentOSMode << 1) | (CurrentLayout << 2);
+}
+
+uint8_t TransformCacheIndex(uint8_t inbuf[8]) {
+    uint8_t hash = CurrentMode;
+    for (uint8_t i = 0; i < 8; i++) {
+        hash = (hash << 1 | hash >> 7) ^ inbuf[i];
+    }
+    return (hash ^ (hash >> 4)) % TransformCacheSize;
+}
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+// TransformBuffer, skipped when the same transformation has been done before
+void CachedTransformBuffer(uint8_t inbuf[8], uint8_t outbuf[8]) {
+    // an empty report runs the tap-release callbacks; the layers below CurrentMode aren't part of the key
+    if (NumKeysOrModsPressed(inbuf) == 0 || HasLowerLayers()) {
+        CountStat(TransformCacheUncachedStat);
+        TransformBuffer(inbuf, outbuf);
+        return;
+    }
+
+    TransformCacheEntry &entry = TransformCache[TransformCacheIndex(inbuf)];
+    uint8_t state = TransformState();
+    if (entry.mode == CurrentMode && entry.state == state && EqualBuffers(entry.inbuf, inbuf)) {
+        CountStat(TransformCacheHitsStat);
+        CopyBuf(entry.outbuf, outbuf);
+        if (entry.nextMode != CurrentMode) SetMode((Mode)entry.nextMode, (ModeState)entry.nextState);
+        else CurrentModeState = (ModeState)entry.nextState;
+        UsageEventDeltas[EnterModeUsage] += entry.enterModes;
+        UsageEventDeltas[InvalidKeyUsage] += entry.invalidKeys;
+        return;
+    }
+
+    uint8_t mode = CurrentMode;
+    uint32_t enterModes = UsageEventDeltas[EnterModeUsage];
+    uint32_t invalidKeys = UsageEventDeltas[InvalidKeyUsage];
+    TransformSideEffect = false;
+    TransformBuffer(inbuf, outbuf);
+
+    if (TransformSideEffect) {
+        CountStat(TransformCacheUncachedStat);
+        return;
+    }
+    CountStat(TransformCacheMissesStat);
+    entry.mode = mode;
+    entry.state = state;
+    CopyBuf(inbuf, entry.inbuf);
+    CopyBuf(outbuf, entry.outbuf);
+    entry.nextMode = CurrentMode;
+    entry.nextState = CurrentModeState;
+    entry.enterModes = UsageEventDeltas[EnterModeUsage] - enterModes;
+    entry.invalidKeys = UsageEventDeltas[InvalidKeyUsage] - invalidKeys;
+}
+
+void InvalidateTransformCache() {
+    for (uint8_t i = 0; i < TransformCacheSize; i++) {
+        TransformCache[i].mode = EmptyEntry;
+    }
+}
+
+void NoteTransformSideEffect() {
+    TransformSideEffect = true;
+}
@@ -0,0 +1,23 @@
+#if !defined(__TRANSFORM_CACHE_H_)
+#define __TRANSFORM_CACHE_H_
+
+#include <Arduino.h>
+
+// Direct-mapped cache of TransformBuffer results. The output of a transformation only depends
+// on the input report, CurrentMode, CurrentModeState, CurrentLayout and CurrentOSMode, so a
+// repeated combination can reuse the output report and resulting mode.
+//
+// Invalidation rules:
+//  - anything that changes what a mode does clears the cache: SetOSMode, SetConfiguration,
+//    custom layout and keymap program uploads
+//  - transformations with effects beyond outbuf and the mode call NoteTransformSideEffect()
+//    and are never stored, e.g. ChangeOSMode, which writes EEPROM
+//  - reports with no keys pressed (tap-release callbacks) are never stored
+//  - neither are transformations with layers below CurrentMode, or those pushing one
+#define TransformCacheSize 8
+
+extern void CachedTransformBuffer(uint8_t inbuf[8], uint8_t outbuf[8]);
+extern void InvalidateTransformCache();
+extern void NoteTransformSideEffect();
+
+#endif // __TRANSFORM_CACHE_H_
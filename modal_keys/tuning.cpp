@@ -0,0 +1,31 @@
+#include "tuning.h"
+#include "eeprom_layout.h"
+
+#include <EEPROM.h>
+
+// defaults, used until a value has been set over the serial port
+const uint16_t DefaultTunings[NumTunings] = {
+    0,      // ComboWindowTuning
+    15,     // UsageFlushMinutesTuning
+    3000,   // OneShotTimeoutTuning
+    2000,   // LeaderTimeoutTuning
+    0,      // HomeRowHoldTuning
+};
+
+uint16_t Tunings[NumTunings];
+
+void LoadTunings() {
+    for (uint8_t i = 0; i < NumTunings; i++) {
+        uint16_t value;
+        EEPROM.get( TuningsSlot + i * sizeof(uint16_t), value );
+        // erased EEPROM reads as 0xFFFF
+        Tunings[i] = (value == 0xFFFF) ? DefaultTunings[i] : value;
+    }
+}
+
+bool SetTuning(uint8_t id, uint16_t value) {
+    if (id >= NumTunings || value == 0xFFFF) return false;
+    Tunings[id] = value;
+    EEPROM.put( TuningsSlot + id * sizeof(uint16_t), value );
+    return true;
+}
@@ -0,0 +1,22 @@
+#if !defined(__TUNING_H_)
+#define __TUNING_H_
+
+#include <Arduino.h>
+
+// Timing parameters that can be adjusted over the serial command interface and are kept in EEPROM.
+// Ids are part of the serial protocol: only ever append new ones.
+typedef enum {
+    ComboWindowTuning = 0,      // ms to wait for the rest of a combo; 0 turns combos off
+    UsageFlushMinutesTuning,    // minutes between writes of the usage counters to EEPROM; 0 turns them off
+    OneShotTimeoutTuning,       // ms an armed one-shot modifier waits for a key; 0 waits forever
+    LeaderTimeoutTuning,        // ms a leader sequence waits for its next key; 0 waits forever
+    HomeRowHoldTuning,          // ms a home-row key held on its own takes to become a modifier; 0 turns them off
+    NumTunings
+} TuningId;
+
+extern uint16_t Tunings[NumTunings];
+
+extern void LoadTunings();
+extern bool SetTuning(uint8_t id, uint16_t value);
+
+#endif // __TUNING_H_
@@ -0,0 +1,230 @@
+#include "modal_keys.h"
+#include "typing.h"
+#include "keymap.h"
+#include "helpers.h"
+#include "report_queue.h"
+#include "stats.h"
+
+// ****************************************************************************
+// Constants
+// ****************************************************************************
+
+const uint8_t HexDigitKeys[16] PROGMEM = {
+    _0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _A, _B, _C, _D, _E, _F
+};
+
+const uint8_t NumpadDigitKeys[10] PROGMEM = {
+    _Numpad0, _Numpad1, _Numpad2, _Numpad3, _Numpad4, _Numpad5, _Numpad6, _Numpad7, _Numpad8, _Numpad9
+};
+
+#define MaxCodePoint 0x10FFFF
+
+// ****************************************************************************
+// Type Declarations
+// ****************************************************************************
+
+typedef enum {
+    CharacterItem = 0,
+    TextItem
+} TypingItemKind;
+
+struct TypingItem {
+    uint8_t kind;
+    uint8_t erase;                  // TextItem: backspaces still to type
+    uint32_t codePoint;             // CharacterItem
+    const uint8_t *keystrokes;      // TextItem: the next one, in flash; 0 ends them
+};
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+TypingItem TypingQueue[TypingQueueSize];
+uint8_t TypingQueueHead = 0;
+uint8_t TypingQueueCount = 0;
+
+// keys that have typed their character, until they are released
+uint8_t TypedKeys[8] = { 0 };
+
+// the first item has been started
+bool ItemStarted = false;
+
+// the character being typed: SequenceMods held while SequenceKeys are tapped
+bool SequenceActive = false;
+uint8_t SequenceMods = 0;
+uint8_t SequenceKeys[MaxTypingKeys];
+uint8_t SequenceLength = 0;
+uint8_t SequenceStep = 0;
+uint32_t SequenceStartMicros = 0;
+
+// ****************************************************************************
+// Helper Functions
+// ****************************************************************************
+
+void AddSequenceKey(uint8_t key) {
+    SequenceKeys[SequenceLength++] = key;
+}
+
+// the low `digits` hex digits of value; numpad for 0-9 on Windows
+void AddHexKeys(uint16_t value, uint8_t digits, bool numpad) {
+    while (digits--) {
+        uint8_t digit = (value >> (digits * 4)) & 0x0F;
+        AddSequenceKey(numpad && digit < 10 ? pgm_read_byte(&NumpadDigitKeys[digit]) : pgm_read_byte(&HexDigitKeys[digit]));
+    }
+}
+
+// the input sequence for codePoint in CurrentOSMode; false if it has none
+bool BuildSequence(uint32_t codePoint) {
+    SequenceLength = 0;
+    SequenceMods = LAlt;
+    if (CurrentOSMode == OSX) {
+        if (codePoint > 0xFFFF) {
+            codePoint -= 0x10000;
+            AddHexKeys(0xD800 + (codePoint >> 10), 4, false);
+            AddHexKeys(0xDC00 + (codePoint & 0x3FF), 4, false);
+        } else {
+            AddHexKeys(codePoint, 4, false);
+        }
+        return true;
+    }
+    // Alt + Numpad0 + decimal types from the ANSI code page, cp1252 in the West, which only
+    // agrees with Unicode up to U+00FF outside of U+0080..U+009F
+    if (codePoint <= 0xFF && (codePoint < 0x80 || codePoint > 0x9F)) {
+        AddSequenceKey(_Numpad0);
+        AddSequenceKey(pgm_read_byte(&NumpadDigitKeys[codePoint / 100]));
+        AddSequenceKey(pgm_read_byte(&NumpadDigitKeys[codePoint / 10 % 10]));
+        AddSequenceKey(pgm_read_byte(&NumpadDigitKeys[codePoint % 10]));
+        return true;
+    }
+    if (codePoint > 0xFFFF) return false;
+    AddSequenceKey(_NumpadPlus);
+    AddHexKeys(codePoint, 4, true);
+    return true;
+}
+
+// a keystroke of TypeText
+void BuildKeystroke(uint8_t keystroke) {
+    SequenceLength = 0;
+    SequenceMods = (keystroke & ShiftedKeystroke) ? LShift : 0;
+    AddSequenceKey(keystroke & ~ShiftedKeystroke);
+}
+
+// Step 0 presses the modifiers, then each key is pressed and released, and the last step
+// releases the modifiers. Without modifiers, the first and the last step would be empty
+// reports and are skipped. Returns false after the last step.
+uint8_t FirstSequenceStep() {
+    return SequenceMods ? 0 : 1;
+}
+
+bool SequenceReport(uint8_t step, uint8_t buf[8]) {
+    memset(buf, 0, 8);
+    if (step > 2 * SequenceLength - (SequenceMods ? 0 : 1)) return false;
+    buf[0] = SequenceMods;
+    if (step % 2) buf[2] = SequenceKeys[step / 2];
+    return true;
+}
+
+// forget the keys that have been released since they typed
+void ForgetReleasedTypedKeys() {
+    for (uint8_t i = 2; i < 8; i++) {
+        if (TypedKeys[i] && !IsKeyPressedInBuffer(TypedKeys[i], InputBuffer)) TypedKeys[i] = 0;
+    }
+}
+
+void FinishItem() {
+    TypingQueueHead = (TypingQueueHead + 1) % TypingQueueSize;
+    TypingQueueCount--;
+    ItemStarted = false;
+}
+
+// the sequence for the next character of the first item; false if there is none
+bool StartNextSequence() {
+    TypingItem *item = &TypingQueue[TypingQueueHead];
+    if (item->kind == CharacterItem) {
+        uint32_t codePoint = item->codePoint;
+        FinishItem();
+        if (BuildSequence(codePoint)) return true;
+        Log(F("typing: no input sequence for code point "), String(codePoint));
+        return false;
+    }
+    ItemStarted = true;
+    if (item->erase) {
+        item->erase--;
+        BuildKeystroke(_Backspace);
+        return true;
+    }
+    uint8_t keystroke = pgm_read_byte(item->keystrokes);
+    if (!keystroke) {
+        FinishItem();
+        return false;
+    }
+    item->keystrokes++;
+    BuildKeystroke(keystroke);
+    return true;
+}
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+// Queue codePoint to be typed, for key (0 for none); false if it is dropped.
+bool TypeCharacter(uint32_t codePoint, uint8_t key) {
+    if (key) {
+        if (IsKeyPressedInBuffer(key, TypedKeys)) return false;
+        MergeKeyIntoBuffer((RichKey){ 0, key }, TypedKeys, false);
+    }
+    if (codePoint > MaxCodePoint || TypingQueueCount == TypingQueueSize) {
+        Log(F("typing: dropped code point "), String(codePoint));
+        return false;
+    }
+    TypingQueue[(TypingQueueHead + TypingQueueCount) % TypingQueueSize] = (TypingItem){ CharacterItem, 0, codePoint, NULL };
+    TypingQueueCount++;
+    return true;
+}
+
+// Queue erase backspaces followed by keystrokes (see ShiftedKeystroke) in flash, ending with 0;
+// false if it is dropped.
+bool TypeText(uint8_t erase, const uint8_t *keystrokes) {
+    if (TypingQueueCount == TypingQueueSize) {
+        Log(F("typing: dropped text"));
+        return false;
+    }
+    TypingQueue[(TypingQueueHead + TypingQueueCount) % TypingQueueSize] = (TypingItem){ TextItem, erase, 0, keystrokes };
+    TypingQueueCount++;
+    return true;
+}
+
+// true while an item is part way through
+bool TypingInProgress() {
+    return SequenceActive || ItemStarted;
+}
+
+bool TypingPending() {
+    return SequenceActive || TypingQueueCount;
+}
+
+// called from loop(): sends the next report of the character being typed, once the previous
+// one has gone out
+void TypingTask() {
+    ForgetReleasedTypedKeys();
+    if (ReportQueueDepth()) return;
+
+    if (!SequenceActive) {
+        if (!TypingQueueCount) return;
+        if (!StartNextSequence()) return;
+        SequenceActive = true;
+        SequenceStep = FirstSequenceStep();
+        SequenceStartMicros = micros();
+    }
+
+    uint8_t buf[8];
+    if (SequenceReport(SequenceStep, buf)) {
+        SequenceStep++;
+    } else {
+        SequenceActive = false;
+        CountStat(TypedCharactersStat);
+        Stats[TypingMicrosStat] += micros() - SequenceStartMicros;
+    }
+    PlayReport(buf);
+    CountStat(TypingReportsStat);
+}
@@ -0,0 +1,36 @@
+#if !defined(__TYPING_H_)
+#define __TYPING_H_
+
+#include <Arduino.h>
+
+// Typing that doesn't come from the keyboard, from a queue that TypingTask works through one
+// report per frame:
+//  - TypeCharacter() types a Unicode code point with the input sequence of CurrentOSMode:
+//    - Windows: Alt + Numpad0 + the decimal code on the numpad up to U+00FF, and
+//      Alt + NumpadPlus + the hex code above that and for U+0080..U+009F, where the decimal
+//      codes type cp1252 instead (needs EnableHexNumpad in the registry), which only goes
+//      up to U+FFFF. Both need Num Lock on: without it the numpad keys are arrows and
+//      Home/End/..., and the host's Num Lock isn't known on every board (see leds.h), so
+//      it isn't turned on here.
+//    - OSX: Option + the hex code, as UTF-16, with the Unicode Hex Input source selected
+//  - TypeText() erases a number of characters with backspaces, then types keystrokes from flash
+// An item's reports are sent as a unit: input reports wait until it is complete, so keys
+// typed meanwhile, or releasing the key that started it, can't end up in the middle of it.
+// A key types its character once per press, however many reports it is held for.
+
+// items waiting to be typed
+#define TypingQueueSize 8
+
+// longest sequence: two UTF-16 units on OSX
+#define MaxTypingKeys 8
+
+// in the keystrokes of TypeText: the key is typed with shift
+#define ShiftedKeystroke 0x80
+
+extern bool TypeCharacter(uint32_t codePoint, uint8_t key);
+extern bool TypeText(uint8_t erase, const uint8_t *keystrokes);
+extern bool TypingInProgress();
+extern bool TypingPending();
+extern void TypingTask();
+
+#endif // __TYPING_H_
@@ -0,0 +1,204 @@
+#include "usage.h"
+#include "eeprom_layout.h"
+#include "tuning.h"
+
+#include <EEPROM.h>
+
+// EEPROM record, kept in UsageSlots alternating slots so each flush only wears half of them and a
+// flush interrupted by a power loss leaves the previous totals intact:
+//   sequence number, checksum, uint16 per key, uint32 seconds per mode, uint32 per UsageEvent
+// The sequence number is written last and the newest slot with a valid checksum is loaded.
+// Key counts are only used relative to each other, so they are all halved when one would overflow.
+#define NumUsageFields (NumUsageKeys + NumModes + NumUsageEvents)
+#define UsageRecordSize (2 + NumUsageKeys * 2 + (NumModes + NumUsageEvents) * 4)
+#define UsageChecksumSeed 0x5A
+#define NoUsageSlot 0xFF
+
+static_assert(UsageRecordSize <= UsageSlotSize, "usage record does not fit its EEPROM slots");
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+uint16_t KeyPressDeltas[NumUsageKeys];
+uint32_t ModeMillisDeltas[NumModes];
+uint32_t UsageEventDeltas[NumUsageEvents];
+uint32_t ModeEnteredMillis = 0;
+
+uint8_t CurrentUsageSlot = NoUsageSlot;
+uint8_t UsageSequence = 0;
+uint32_t LastUsageFlushMillis = 0;
+
+// state of the flush in progress, which writes one byte per UsageTask call
+bool FlushingUsage = false;
+uint8_t FlushSlot;
+uint8_t FlushField;
+uint8_t FlushByte;
+uint8_t FlushChecksum;
+bool FlushHalveKeys;
+uint32_t FlushValue;
+uint32_t FlushDelta;
+
+// ****************************************************************************
+// Helper Functions
+// ****************************************************************************
+
+uint16_t UsageSlotAddress(uint8_t slot) {
+    return UsageSlots + slot * UsageSlotSize;
+}
+
+uint16_t UsageFieldOffset(uint8_t field) {
+    if (field < NumUsageKeys) return 2 + field * 2;
+    return 2 + NumUsageKeys * 2 + (field - NumUsageKeys) * 4;
+}
+
+uint8_t UsageFieldSize(uint8_t field) {
+    return field < NumUsageKeys ? 2 : 4;
+}
+
+uint32_t ReadUsageField(uint8_t slot, uint8_t field) {
+    if (slot == NoUsageSlot) return 0;
+    uint16_t address = UsageSlotAddress(slot) + UsageFieldOffset(field);
+    uint32_t value = 0;
+    for (uint8_t i = UsageFieldSize(field); i > 0; i--) {
+        value = (value << 8) | EEPROM.read(address + i - 1);
+    }
+    return value;
+}
+
+// counts in RAM not yet in EEPROM, in the units stored there
+uint32_t UsageFieldDelta(uint8_t field) {
+    if (field < NumUsageKeys) return KeyPressDeltas[field];
+    if (field < NumUsageKeys + NumModes) return ModeMillisDeltas[field - NumUsageKeys] / 1000;
+    return UsageEventDeltas[field - NumUsageKeys - NumModes];
+}
+
+// Subtract what has been written rather than clearing, the counts may have moved on since.
+void ConsumeUsageFieldDelta(uint8_t field, uint32_t delta) {
+    if (field < NumUsageKeys) KeyPressDeltas[field] -= delta;
+    else if (field < NumUsageKeys + NumModes) ModeMillisDeltas[field - NumUsageKeys] -= delta * 1000;
+    else UsageEventDeltas[field - NumUsageKeys - NumModes] -= delta;
+}
+
+bool IsUsageSlotValid(uint8_t slot) {
+    uint16_t address = UsageSlotAddress(slot);
+    uint8_t checksum = UsageChecksumSeed;
+    for (uint16_t i = 2; i < UsageRecordSize; i++) {
+        checksum += EEPROM.read(address + i);
+    }
+    return checksum == EEPROM.read(address + 1);
+}
+
+void WriteNextUsageByte() {
+    uint16_t address = UsageSlotAddress(FlushSlot);
+    if (FlushField < NumUsageFields) {
+        if (FlushByte == 0) {
+            FlushDelta = UsageFieldDelta(FlushField);
+            FlushValue = ReadUsageField(CurrentUsageSlot, FlushField) + FlushDelta;
+            if (FlushHalveKeys && FlushField < NumUsageKeys) FlushValue >>= 1;
+        }
+        uint8_t value = FlushValue >> (FlushByte * 8);
+        EEPROM.update(address + UsageFieldOffset(FlushField) + FlushByte, value);
+        FlushChecksum += value;
+        if (++FlushByte == UsageFieldSize(FlushField)) {
+            ConsumeUsageFieldDelta(FlushField, FlushDelta);
+            FlushField++;
+            FlushByte = 0;
+        }
+    } else if (FlushField == NumUsageFields) {
+        EEPROM.update(address + 1, FlushChecksum);
+        FlushField++;
+    } else {
+        EEPROM.update(address, ++UsageSequence);
+        CurrentUsageSlot = FlushSlot;
+        FlushingUsage = false;
+    }
+}
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+void LoadUsage() {
+    for (uint8_t slot = 0; slot < 2; slot++) {
+        if (!IsUsageSlotValid(slot)) continue;
+        uint8_t sequence = EEPROM.read(UsageSlotAddress(slot));
+        if (CurrentUsageSlot == NoUsageSlot || (int8_t)(sequence - UsageSequence) > 0) {
+            CurrentUsageSlot = slot;
+            UsageSequence = sequence;
+        }
+    }
+    ModeEnteredMillis = millis();
+}
+
+// count the keys in buf that weren't pressed in prevbuf
+void CountKeyPresses(uint8_t buf[8], uint8_t prevbuf[8]) {
+    for (uint8_t i = 2; i < 8; i++) {
+        uint8_t key = buf[i];
+        if (key == 0) break;
+        bool wasPressed = false;
+        for (uint8_t j = 2; j < 8 && prevbuf[j] != 0; j++) {
+            if (prevbuf[j] == key) {
+                wasPressed = true;
+                break;
+            }
+        }
+        if (!wasPressed) CountKeyPress(key);
+    }
+}
+
+uint8_t NumUsageCounters(uint8_t kind) {
+    switch (kind) {
+        case KeyPressesUsage: return NumUsageKeys;
+        case ModeSecondsUsage: return NumModes;
+        case EventsUsage: return NumUsageEvents;
+    }
+    return 0;
+}
+
+// total of a counter: EEPROM plus what hasn't been flushed yet
+uint32_t GetUsageCounter(uint8_t kind, uint8_t index) {
+    uint8_t field = index;
+    if (kind >= ModeSecondsUsage) field += NumUsageKeys;
+    if (kind >= EventsUsage) field += NumModes;
+    if (kind == ModeSecondsUsage && index == CurrentMode) CountModeTime(CurrentMode);
+
+    // fields already written by a flush in progress have had their deltas consumed
+    uint8_t slot = (FlushingUsage && field < FlushField) ? FlushSlot : CurrentUsageSlot;
+    return ReadUsageField(slot, field) + UsageFieldDelta(field);
+}
+
+// Start writing the counts to EEPROM. UsageTask writes the record a byte at a time, whenever
+// the EEPROM is ready, so the key path is never blocked by the ~3.3ms per byte write time.
+void FlushUsage() {
+    if (FlushingUsage) return;
+    CountModeTime(CurrentMode);
+
+    FlushHalveKeys = false;
+    for (uint8_t field = 0; field < NumUsageKeys; field++) {
+        if (ReadUsageField(CurrentUsageSlot, field) + KeyPressDeltas[field] > 0xFFFF) {
+            FlushHalveKeys = true;
+            break;
+        }
+    }
+    FlushSlot = CurrentUsageSlot == 0 ? 1 : 0;
+    FlushField = 0;
+    FlushByte = 0;
+    FlushChecksum = UsageChecksumSeed;
+    FlushingUsage = true;
+    LastUsageFlushMillis = millis();
+}
+
+bool IsFlushingUsage() {
+    return FlushingUsage;
+}
+
+// called from loop()
+void UsageTask() {
+    if (FlushingUsage) {
+        if (eeprom_is_ready()) WriteNextUsageByte();
+        return;
+    }
+    uint16_t minutes = Tunings[UsageFlushMinutesTuning];
+    if (minutes != 0 && millis() - LastUsageFlushMillis >= minutes * 60000UL) FlushUsage();
+}
@@ -0,0 +1,64 @@
+#if !defined(__USAGE_H_)
+#define __USAGE_H_
+
+#include <Arduino.h>
+#include "keys.h"
+#include "keymap.h"
+
+// Usage counters: how often each key is pressed, how long is spent in each mode and how often
+// the mode engine takes some paths. They are counted in RAM, added to the totals in EEPROM
+// every UsageFlushMinutesTuning minutes and can be read over the serial command interface.
+
+// keys _A to _Up are counted
+#define FirstUsageKey _A
+#define LastUsageKey _Up
+#define NumUsageKeys (LastUsageKey - FirstUsageKey + 1)
+
+// Ids are part of the serial protocol: only ever append new ones.
+typedef enum {
+    EnterModeUsage = 0,
+    TapReleaseUsage,
+    InvalidKeyUsage,
+    NumUsageEvents
+} UsageEvent;
+
+// kinds of counters for GetUsageCommand
+typedef enum {
+    KeyPressesUsage = 0,        // presses per key, starting at FirstUsageKey
+    ModeSecondsUsage,           // seconds spent per Mode
+    EventsUsage,                // UsageEvent counts
+    NumUsageKinds
+} UsageKind;
+
+// counts since the last flush to EEPROM
+extern uint16_t KeyPressDeltas[NumUsageKeys];
+extern uint32_t ModeMillisDeltas[NumModes];
+extern uint32_t UsageEventDeltas[NumUsageEvents];
+extern uint32_t ModeEnteredMillis;
+
+inline void CountKeyPress(uint8_t key) {
+    if (key >= FirstUsageKey && key <= LastUsageKey && KeyPressDeltas[key - FirstUsageKey] != 0xFFFF) {
+        KeyPressDeltas[key - FirstUsageKey]++;
+    }
+}
+
+inline void CountUsageEvent(UsageEvent event) {
+    UsageEventDeltas[event]++;
+}
+
+// call before leaving CurrentMode
+inline void CountModeTime(Mode mode) {
+    uint32_t now = millis();
+    ModeMillisDeltas[mode] += now - ModeEnteredMillis;
+    ModeEnteredMillis = now;
+}
+
+extern void LoadUsage();
+extern void CountKeyPresses(uint8_t buf[8], uint8_t prevbuf[8]);
+extern uint8_t NumUsageCounters(uint8_t kind);
+extern uint32_t GetUsageCounter(uint8_t kind, uint8_t index);
+extern void FlushUsage();
+extern bool IsFlushingUsage();
+extern void UsageTask();
+
+#endif // __USAGE_H_
@@ -0,0 +1,87 @@
+#include "modal_keys.h"
+#include "usb_watchdog.h"
+#include "boot_timeline.h"
+#include "leds.h"
+#include "stats.h"
+
+// ****************************************************************************
+// Variables
+// ****************************************************************************
+
+// the keyboard is running; false until the first enumeration
+bool UsbRunning = false;
+// it is being recovered from a fault
+bool UsbFaulted = false;
+
+uint8_t LastUsbHostState = UsbHostNoDevice;
+uint32_t UsbHostStateSince = 0;
+
+// when recovery started to count, and the restarts since
+uint32_t UsbRecoverySince = 0;
+uint32_t UsbRestartedMillis = 0;
+uint8_t UsbRestarts = 0;
+
+// ****************************************************************************
+// Helper Functions
+// ****************************************************************************
+
+void NoteUsbFault(uint32_t now) {
+    UsbRunning = false;
+    UsbFaulted = true;
+    UsbRecoverySince = now;
+    UsbRestarts = 0;
+    CountStat(UsbFaultsStat);
+    ResetInput();
+    Log(F("usb: keyboard lost, keys released"));
+}
+
+void NoteUsbRecovery(uint32_t now) {
+    UsbRunning = true;
+    NoteBootStage(KeyboardReadyStage);
+    ResendKeyboardLeds();
+    if (!UsbFaulted) return;
+    UsbFaulted = false;
+    uint32_t elapsed = now - UsbRecoverySince;
+    CountStat(UsbRecoveriesStat);
+    Stats[UsbRecoveryTotalMillisStat] += elapsed;
+    if (elapsed > Stats[UsbRecoveryMaxMillisStat]) Stats[UsbRecoveryMaxMillisStat] = elapsed;
+    Log(F("usb: keyboard back after "), String(elapsed) + " ms");
+}
+
+// ****************************************************************************
+// Shared Function Implementations
+// ****************************************************************************
+
+// called from loop()
+void UsbWatchdogTask() {
+    uint32_t now = millis();
+    UsbHostState state = GetUsbHostState();
+    if (state != LastUsbHostState) {
+        LastUsbHostState = state;
+        UsbHostStateSince = now;
+    }
+
+    if (state == UsbHostRunning) {
+        if (!UsbRunning) NoteUsbRecovery(now);
+        return;
+    }
+    if (UsbRunning) NoteUsbFault(now);
+
+    // Waiting for a device isn't part of recovering from the fault, and a new one starts afresh.
+    // Right after a restart, the device hasn't been found again yet.
+    if (state == UsbHostNoDevice) {
+        if (UsbRestarts && now - UsbRestartedMillis < UsbRestartMillis) return;
+        UsbRecoverySince = now;
+        UsbRestarts = 0;
+        return;
+    }
+    bool stuck = state != UsbHostEnumerating || now - UsbHostStateSince >= UsbEnumerationMillis;
+    if (!stuck || (UsbRestarts && now - UsbRestartedMillis < UsbRestartMillis)) return;
+
+    bool resetController = UsbRestarts || state == UsbHostControllerReset;
+    UsbRestartedMillis = now;
+    UsbRestarts++;
+    CountStat(UsbRestartsStat);
+    Log(resetController ? F("usb: resetting the host controller") : F("usb: restarting enumeration"));
+    RestartUsbHost(resetController);
+}
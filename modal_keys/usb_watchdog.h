@@ -0,0 +1,35 @@
+#if !defined(__USB_WATCHDOG_H_)
+#define __USB_WATCHDOG_H_
+
+#include <Arduino.h>
+
+// Watches the connection to the keyboard. When it goes away (unplugged, switched away by a KVM,
+// the USB host controller reset) or stops working, the keys it held are released on the host at
+// once (ResetInput), instead of staying stuck until it comes back. Enumeration that hangs or fails
+// is restarted, at startup too: first by the host library, then, every UsbRestartMillis, with a
+// reset of the host controller as well, which a controller that was reset gets straight away.
+// The configuration is kept; the keyboard's LEDs are set again once it is back.
+//
+// Recovery time is measured from the moment a device is attached again, or from the fault if it
+// never went away, until the keyboard is polled again.
+
+// enumeration taking longer than this has hung
+#define UsbEnumerationMillis 500
+#define UsbRestartMillis 1000
+
+// what the platform's USB host is doing
+typedef enum {
+    UsbHostRunning = 0,         // the keyboard is enumerated and polled
+    UsbHostEnumerating,         // a device is attached and being configured
+    UsbHostNoDevice,            // nothing attached
+    UsbHostFault,               // the keyboard is in an error state
+    UsbHostControllerReset      // the host controller lost its configuration, e.g. in a brown-out
+} UsbHostState;
+
+// provided by the platform: the sketch or the Linux daemon
+extern UsbHostState GetUsbHostState();
+extern void RestartUsbHost(bool resetController);
+
+extern void UsbWatchdogTask();
+
+#endif // __USB_WATCHDOG_H_
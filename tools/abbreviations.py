@@ -0,0 +1,196 @@
+#!/usr/bin/env python3
+"""Compile the abbreviations into the automaton the sketch expands them with.
+
+Reads tools/abbreviations.txt and writes modal_keys/abbreviation_dfa.h (see
+modal_keys/abbreviations.h). The abbreviations are compiled into an Aho-Corasick automaton
+with every failure link followed ahead of time, so each keystroke is one table lookup however
+many abbreviations there are. Characters are turned into the key combos that type them on the
+host, the reverse of modal_keys/layout_qwerty.h.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+from modal_keys_cli import SKETCH_DIR, read_defines, eval_define
+
+TOOLS_DIR = os.path.dirname(os.path.abspath(__file__))
+
+# must match abbreviations.h and typing.h
+CLASS_SHIFT = 0x40
+SHIFTED_KEYSTROKE = 0x80
+MAX_STATES = 255
+
+
+def read_key_combos():
+    """Return a dict from each character to its (key, shift) on the host."""
+    defines = read_defines("keys.h")
+    with open(os.path.join(SKETCH_DIR, "layout_qwerty.h")) as f:
+        text = f.read()
+    combos = {" ": (eval_define("_Space", defines), False)}
+    for match in re.finditer(r"=>\s+(\S+)\s*\*/\s*\(KeySpec\)\s*\{([^}]*)\}", text):
+        chars = match.group(1)
+        if len(chars) != 2:
+            continue
+        fields = [eval_define(field.strip(), defines) for field in match.group(2).split(",")]
+        combos.setdefault(chars[0], (fields[1], fields[0] != 0))
+        combos.setdefault(chars[1], (fields[3], fields[2] != 0))
+    return combos
+
+
+def read_abbreviations(path, combos):
+    abbreviations = []
+    with open(path) as f:
+        for number, line in enumerate(f, 1):
+            line = line.rstrip("\n")
+            if not line.strip() or line.lstrip().startswith("#"):
+                continue
+            fields = line.split(None, 1)
+            if len(fields) != 2:
+                raise SystemExit("%s:%d: expected 'abbreviation expansion'" % (path, number))
+            for char in line:
+                if char not in combos:
+                    raise SystemExit("%s:%d: no key types '%s'" % (path, number, char))
+            abbreviations.append((fields[0], fields[1].strip()))
+    for short, _ in abbreviations:
+        for other, _ in abbreviations:
+            if short != other and short in other:
+                raise SystemExit("abbreviation %s is part of %s, which would never expand" % (short, other))
+    return abbreviations
+
+
+def symbol(char, combos):
+    key, shift = combos[char]
+    if key >= CLASS_SHIFT:
+        raise SystemExit("'%s' can't be part of an abbreviation" % char)
+    return key | (CLASS_SHIFT if shift else 0)
+
+
+def build_automaton(abbreviations, combos):
+    """Return the transition table by state and class, the match of each state, and the classes."""
+    symbols = sorted({symbol(char, combos) for short, _ in abbreviations for char in short})
+    classes = {s: n + 1 for n, s in enumerate(symbols)}  # class 0: keys in no abbreviation
+
+    # the trie
+    edges = [{}]
+    matches = [0]
+    for n, (short, _) in enumerate(abbreviations):
+        state = 0
+        for char in short:
+            c = classes[symbol(char, combos)]
+            if c not in edges[state]:
+                edges[state][c] = len(edges)
+                edges.append({})
+                matches.append(0)
+            state = edges[state][c]
+        matches[state] = n + 1
+
+    # breadth first, so each state's failure state is complete before it is needed
+    count = len(classes) + 1
+    table = [[0] * count for _ in edges]
+    fail = [0] * len(edges)
+    queue = []
+    for c, child in edges[0].items():
+        table[0][c] = child
+        queue.append(child)
+    for state in queue:
+        if not matches[state]:
+            matches[state] = matches[fail[state]]
+        for c in range(1, count):
+            child = edges[state].get(c)
+            if child is None:
+                table[state][c] = table[fail[state]][c]
+            else:
+                fail[child] = table[fail[state]][c]
+                table[state][c] = child
+                queue.append(child)
+    if len(edges) > MAX_STATES:
+        raise SystemExit("too many abbreviations: %d states" % len(edges))
+    return table, matches, classes
+
+
+def keystrokes(text, combos):
+    return [key | (SHIFTED_KEYSTROKE if shift else 0) for key, shift in (combos[char] for char in text)]
+
+
+def generate(abbreviations, table, matches, classes, combos):
+    lines = [
+        "#if !defined(__ABBREVIATION_DFA_H_)",
+        "#define __ABBREVIATION_DFA_H_",
+        "",
+        "// generated by tools/abbreviations.py from tools/abbreviations.txt, don't edit",
+        "",
+        '#include "abbreviations.h"',
+        "",
+        "#define NumAbbreviationClasses %d" % len(table[0]),
+        "",
+        "// class of each key | AbbreviationClassShift if shifted",
+        "const uint8_t AbbreviationClasses[2 * AbbreviationClassShift] PROGMEM = {",
+    ]
+    row = [classes.get(s, 0) for s in range(2 * CLASS_SHIFT)]
+    for start in range(0, len(row), 16):
+        lines.append("    " + ", ".join("%2d" % c for c in row[start:start + 16]) + ",")
+    lines += [
+        "};",
+        "",
+        "// next state by state and class",
+        "const uint8_t AbbreviationNext[][NumAbbreviationClasses] PROGMEM = {",
+    ]
+    for state, next_states in enumerate(table):
+        lines.append("    /* %3d */ { %s }," % (state, ", ".join(str(s) for s in next_states)))
+    lines += [
+        "};",
+        "",
+        "// the abbreviation (index + 1) each state completes, or 0",
+        "const uint8_t AbbreviationMatches[] PROGMEM = {",
+    ]
+    for start in range(0, len(matches), 16):
+        lines.append("    " + ", ".join(str(m) for m in matches[start:start + 16]) + ",")
+    lines += [
+        "};",
+        "",
+        "// by abbreviation: keys to erase, offset of the expansion in AbbreviationTexts",
+        "const AbbreviationExpansion AbbreviationExpansions[] PROGMEM = {",
+    ]
+    texts = []
+    offset = 0
+    for short, text in abbreviations:
+        lines.append("    /* %-8s */ { %d, %d }," % (short, len(short), offset))
+        texts.append((short, text, keystrokes(text, combos) + [0]))
+        offset += len(texts[-1][2])
+    lines += [
+        "};",
+        "",
+        "// keystrokes, key | ShiftedKeystroke if shifted, each expansion ending with 0",
+        "const uint8_t AbbreviationTexts[] PROGMEM = {",
+    ]
+    for short, text, keys in texts:
+        lines.append("    // %s" % text)
+        lines.append("    " + ", ".join("0x%02X" % k for k in keys) + ",")
+    lines += [
+        "};",
+        "",
+        "#endif // __ABBREVIATION_DFA_H_",
+        "",
+    ]
+    return "\n".join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("abbreviations", nargs="?", default=os.path.join(TOOLS_DIR, "abbreviations.txt"))
+    parser.add_argument("-o", "--output", default=os.path.join(SKETCH_DIR, "abbreviation_dfa.h"))
+    args = parser.parse_args()
+
+    combos = read_key_combos()
+    abbreviations = read_abbreviations(args.abbreviations, combos)
+    table, matches, classes = build_automaton(abbreviations, combos)
+    with open(args.output, "w") as f:
+        f.write(generate(abbreviations, table, matches, classes, combos))
+    print("%d abbreviations, %d states, %d classes, %d bytes of table" %
+          (len(abbreviations), len(table), len(table[0]), len(table) * len(table[0])), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
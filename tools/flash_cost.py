@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+"""Report the flash cost of the engine's compile-time specializations.
+
+Every OS policy of MapKeyToLayout (modal_keys/keymap.cpp) is a separate function. This lists
+their sizes from the symbol table of a build:
+
+    arduino-cli compile --fqbn arduino:avr:leonardo --output-dir build modal_keys
+    tools/flash_cost.py --nm avr-nm build/modal_keys.ino.elf
+
+or, for the Linux daemon, `make -C linux flash-cost`.
+"""
+
+import argparse
+import re
+import subprocess
+import sys
+
+SPECIALIZATIONS = [r"MapKeyToLayout<"]
+
+
+def symbol_sizes(nm, paths):
+    output = subprocess.run([nm, "--demangle", "--print-size", "--size-sort"] + paths,
+                            check=True, capture_output=True, text=True).stdout
+    sizes = {}
+    for line in output.splitlines():
+        match = re.match(r"[0-9a-fA-F]+ ([0-9a-fA-F]+) [tTwW] (.*)$", line)
+        if match:
+            # weak symbols show up once per object file, but are only linked once
+            sizes[match.group(2)] = int(match.group(1), 16)
+    return sizes
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--nm", default="nm", help="nm of the target toolchain, e.g. avr-nm")
+    parser.add_argument("paths", nargs="+", help="ELF file or object files")
+    args = parser.parse_args()
+
+    sizes = symbol_sizes(args.nm, args.paths)
+    total = 0
+    for name, size in sorted(sizes.items()):
+        if any(re.search(pattern, name) for pattern in SPECIALIZATIONS):
+            print("%6d  %s" % (size, re.sub(r"\(.*\)$", "", name)))
+            total += size
+    if not total:
+        sys.exit("no specializations found")
+    print("%6d  total" % total)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""Compile the leader sequences into the trie the sketch matches them with.
+
+Reads tools/leader_sequences.txt and writes modal_keys/leader_trie.h (see modal_keys/leader.h
+for the format). Each node is stored as the list of its edges, so matching a key is one scan
+of the current node's edges, however many sequences there are.
+"""
+
+import argparse
+import os
+import sys
+
+from modal_keys_cli import SKETCH_DIR, read_enum, read_defines, name_to_index
+
+TOOLS_DIR = os.path.dirname(os.path.abspath(__file__))
+
+# action -> (LeaderActionKind, function turning the argument into the C value)
+ACTIONS = {
+    "profile": ("LeaderProfile", lambda arg: str(int(arg) - 1)),
+    "os": ("LeaderOSMode", lambda arg: read_enum("keymap.h", "OSMode")[
+        name_to_index(read_enum("keymap.h", "OSMode"), arg, "OS mode")]),
+    "layout": ("LeaderLayout", lambda arg: read_enum("keymap.h", "KeyboardLayout")[
+        name_to_index(read_enum("keymap.h", "KeyboardLayout"), arg, "layout")]),
+    "entry": ("LeaderEntryPoint", lambda arg: read_enum("keymap.h", "Mode")[
+        name_to_index(read_enum("keymap.h", "Mode"), arg, "mode")]),
+}
+
+# must match LeaderLeaf in leader.h
+LEAF = 0x80
+
+
+def read_sequences(path):
+    sequences = []
+    with open(path) as f:
+        for number, line in enumerate(f, 1):
+            line = line.split("#")[0].strip()
+            if not line:
+                continue
+            fields = line.split()
+            if len(fields) != 3 or fields[1] not in ACTIONS:
+                raise SystemExit("%s:%d: expected 'sequence action argument'" % (path, number))
+            sequence, action, arg = fields
+            if not sequence.isalnum():
+                raise SystemExit("%s:%d: sequences are letters and digits" % (path, number))
+            kind, value = ACTIONS[action]
+            sequences.append((sequence.upper(), kind, value(arg)))
+    return sequences
+
+
+def build_trie(sequences):
+    """Return the nodes, breadth first, as dicts from key to child node or action index, and the actions."""
+    root = {}
+    actions = []
+    for sequence, kind, value in sequences:
+        node = root
+        for n, char in enumerate(sequence):
+            last = n == len(sequence) - 1
+            child = node.get(char)
+            if isinstance(child, int) or (child is not None and last):
+                raise SystemExit("sequence %s overlaps another one" % sequence.lower())
+            if last:
+                node[char] = len(actions)
+                actions.append((sequence.lower(), kind, value))
+            else:
+                node = node.setdefault(char, {})
+
+    nodes = [root]
+    for node in nodes:
+        for char in sorted(node):
+            if isinstance(node[char], dict):
+                nodes.append(node[char])
+    return nodes, actions
+
+
+def key_name(char):
+    return "_" + char
+
+
+def generate(nodes, actions):
+    keys = read_defines("keys.h")
+    # offset of each node's first edge; every node ends with a terminating edge
+    offsets = []
+    offset = 0
+    for node in nodes:
+        offsets.append(offset)
+        offset += len(node) + 1
+    if offset > LEAF or len(actions) > LEAF:
+        raise SystemExit("too many sequences: %d edges, %d actions" % (offset, len(actions)))
+
+    lines = [
+        "#if !defined(__LEADER_TRIE_H_)",
+        "#define __LEADER_TRIE_H_",
+        "",
+        "// generated by tools/leader_trie.py from tools/leader_sequences.txt, don't edit",
+        "",
+        '#include "keys.h"',
+        '#include "keymap.h"',
+        '#include "leader.h"',
+        "",
+        "// the edges of each node, each node ending with key 0; the root is the first",
+        "const LeaderEdge LeaderTrie[] PROGMEM = {",
+    ]
+    index = {id(node): n for n, node in enumerate(nodes)}
+    prefixes = {id(nodes[0]): ""}
+    for node, offset in zip(nodes, offsets):
+        edges = []
+        for char in sorted(node):
+            if key_name(char) not in keys:
+                raise SystemExit("no key for '%s'" % char.lower())
+            child = node[char]
+            if isinstance(child, dict):
+                prefixes[id(child)] = prefixes[id(node)] + char.lower()
+                target = str(offsets[index[id(child)]])
+            else:
+                target = "LeaderLeaf | %d" % child
+            edges.append("{ %s, %s }" % (key_name(char), target))
+        edges.append("{ 0, 0 }")
+        label = "%3d %-4s" % (offset, prefixes[id(node)] or "-")
+        lines.append("    /* %s */ %s," % (label, ", ".join(edges)))
+    lines += [
+        "};",
+        "",
+        "const LeaderAction LeaderActions[] PROGMEM = {",
+    ]
+    for n, (sequence, kind, value) in enumerate(actions):
+        lines.append("    /* %3d %-4s */ { %s, %s }," % (n, sequence, kind, value))
+    lines += [
+        "};",
+        "",
+        "#endif // __LEADER_TRIE_H_",
+        "",
+    ]
+    return "\n".join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("sequences", nargs="?", default=os.path.join(TOOLS_DIR, "leader_sequences.txt"))
+    parser.add_argument("-o", "--output", default=os.path.join(SKETCH_DIR, "leader_trie.h"))
+    args = parser.parse_args()
+
+    nodes, actions = build_trie(read_sequences(args.sequences))
+    with open(args.output, "w") as f:
+        f.write(generate(nodes, actions))
+    print("%d sequences, %d nodes" % (len(actions), len(nodes)), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,549 @@
+#!/usr/bin/env python3
+"""Command line client for the ArduinoModalKeys serial command protocol.
+
+Frames look like
+
+    SOF(0x7E) | LEN | TYPE | PAYLOAD[LEN] | CRC16 (low byte first)
+
+with CRC-16/CCITT (poly 0x1021, init 0xFFFF) over LEN, TYPE and PAYLOAD.
+See modal_keys/framing.h and modal_keys/commands.h.
+
+The enum names (modes, layouts, stats) are read from the sketch headers so
+that this client stays in sync with the firmware it ships with.
+
+Requires pyserial (pip install pyserial).
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+import time
+
+SKETCH_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "modal_keys")
+
+FRAME_START = 0x7E
+MAX_FRAME_PAYLOAD = 32
+RESPONSE_FLAG = 0x80
+UNCHANGED = 0xFF
+
+(PING, GET_CONFIG, SET_CONFIG, UPLOAD_KEYMAP, GET_STATS, RESET_STATS, SET_TRACE,
+ UPLOAD_PROGRAMS, COMMIT_PROGRAMS, BENCHMARK, GET_TUNING, SET_TUNING, GET_USAGE,
+ FLUSH_USAGE, ACTIVATE_PROFILE, GET_TASK_STATS, SET_HOST_LEDS, GET_BOOT_STAGE) = range(1, 19)
+
+# keymap program opcodes, see modal_keys/keymap_vm.h: name -> (opcode, operand kinds)
+VM_CONDITIONS = {
+    "mod": (0x01, "m"),
+    "any-mod": (0x02, ""),
+    "first-key": (0x03, "k"),
+    "key": (0x04, "k"),
+    "any-key": (0x05, ""),
+    "first-key-not": (0x06, "k"),
+    "only-mods": (0x07, "m"),
+}
+VM_ACTIONS = {
+    "send-key": (0x40, "k"),
+    "send-mods": (0x41, "m"),
+    "send-combo": (0x42, "mk"),
+    "send-only-key": (0x43, "k"),
+    "enter": (0x44, "Ms"),
+    "continue": (0x45, ""),
+    "stop": (0x46, ""),
+    "restart": (0x47, ""),
+    "invalid": (0x48, ""),
+    "layout": (0x49, ""),
+    "native": (0x4A, ""),
+    "one-shot": (0x4B, "m"),
+    "leader": (0x4C, ""),
+}
+VM_END_OF_IMAGE = 0xFF
+
+STATUS = ["ok", "bad length", "bad argument", "unknown command", "busy"]
+BUSY = 4
+
+
+# ----------------------------------------------------------------------------
+# Sketch headers
+# ----------------------------------------------------------------------------
+
+def read_header(name):
+    with open(os.path.join(SKETCH_DIR, name)) as f:
+        return f.read()
+
+
+def read_enum(header, type_name):
+    """Return the member names of `typedef enum { ... } type_name;` in order."""
+    text = re.sub(r"//[^\n]*", "", read_header(header))
+    match = re.search(r"typedef\s+enum\s*\{([^}]*)\}\s*" + type_name + r"\s*;", text)
+    if not match:
+        raise SystemExit("could not find enum %s in %s" % (type_name, header))
+    names = []
+    for member in match.group(1).split(","):
+        member = member.strip()
+        if not member:
+            continue
+        name, _, value = member.partition("=")
+        if value.strip():
+            if len(names) != int(value.strip(), 0):
+                raise SystemExit("unsupported enum numbering in %s" % type_name)
+        names.append(name.strip())
+    return names
+
+
+def read_defines(header):
+    defines = {}
+    for match in re.finditer(r"^#define[ \t]+(\w+)[ \t]+(.+?)[ \t]*$", read_header(header), re.M):
+        defines[match.group(1)] = match.group(2)
+    return defines
+
+
+def eval_define(expr, defines):
+    expr = re.sub(r"\b(_?\w+)\b",
+                  lambda m: "(%s)" % eval_define(defines[m.group(1)], defines)
+                  if m.group(1) in defines else m.group(1), expr)
+    return int(eval(expr, {"__builtins__": {}}))
+
+
+def read_layout(path):
+    """Parse the KeySpec entries out of a layout_*.h style header."""
+    defines = read_defines("keys.h")
+    with open(path) as f:
+        text = f.read()
+    specs = []
+    for match in re.finditer(r"\(KeySpec\)\s*\{([^}]*)\}", text):
+        fields = [field.strip() for field in match.group(1).split(",")]
+        specs.append([eval_define(field, defines) for field in fields])
+    return specs
+
+
+def assemble_programs(path):
+    """Assemble a keymap program source file into a program image.
+
+    A `mode <Mode>` line starts the program for a mode. Every other line is one case:
+    zero or more conditions, a colon, and an action, e.g.
+
+        mode LeftAlt
+            mod LAlt: continue
+            first-key _X: enter NumPad used
+            key _Q: send-mods LShift
+            native
+    """
+    defines = read_defines("keys.h")
+    modes = read_enum("keymap.h", "Mode")
+    operand_parsers = {
+        "k": lambda word: eval_define(word if word in defines or word.isdigit() else "_" + word, defines),
+        "m": lambda word: eval_define(word, defines),
+        "M": lambda word: name_to_index(modes, word, "mode"),
+        "s": lambda word: ["clean", "used"].index(word.lower()),
+    }
+
+    def encode(table, words, what, line_number):
+        name = words.pop(0)
+        if name not in table:
+            raise SystemExit("%s:%d: unknown %s '%s'" % (path, line_number, what, name))
+        opcode, kinds = table[name]
+        code = [opcode]
+        for kind in kinds:
+            if not words:
+                raise SystemExit("%s:%d: missing operand for '%s'" % (path, line_number, name))
+            code.append(operand_parsers[kind](words.pop(0)))
+        return code
+
+    programs = []
+    with open(path) as f:
+        for line_number, line in enumerate(f, 1):
+            line = line.split("#")[0].strip()
+            if not line:
+                continue
+            if line.startswith("mode "):
+                programs.append((name_to_index(modes, line.split()[1], "mode"), []))
+                continue
+            if not programs:
+                raise SystemExit("%s:%d: case outside of a mode" % (path, line_number))
+            conditions, _, action = line.rpartition(":")
+            code = programs[-1][1]
+            words = conditions.split()
+            while words:
+                code += encode(VM_CONDITIONS, words, "condition", line_number)
+            words = action.split()
+            code += encode(VM_ACTIONS, words, "action", line_number)
+            if words:
+                raise SystemExit("%s:%d: unexpected '%s'" % (path, line_number, " ".join(words)))
+
+    image = []
+    for mode, code in programs:
+        image += [mode, len(code)] + code
+    image.append(VM_END_OF_IMAGE)
+    size = eval_define("KeymapProgramsSize", read_defines("eeprom_layout.h"))
+    if len(image) > size:
+        raise SystemExit("program image is %d bytes, only %d fit" % (len(image), size))
+    return bytes(image)
+
+
+def name_to_index(names, value, what):
+    for i, name in enumerate(names):
+        if value.lower() in (name.lower(), re.sub("(mode|tuning|stat)$", "", name.lower())):
+            return i
+    raise SystemExit("unknown %s '%s' (one of: %s)" % (what, value, ", ".join(names)))
+
+
+# ----------------------------------------------------------------------------
+# Framing
+# ----------------------------------------------------------------------------
+
+def crc16(data, crc=0xFFFF):
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021 if crc & 0x8000 else crc << 1) & 0xFFFF
+    return crc
+
+
+def encode_frame(frame_type, payload=b""):
+    body = bytes([len(payload), frame_type]) + bytes(payload)
+    crc = crc16(body)
+    return bytes([FRAME_START]) + body + bytes([crc & 0xFF, crc >> 8])
+
+
+class FrameReader:
+    """Incremental frame decoder; anything outside a valid frame is log text."""
+
+    def __init__(self, on_text=None):
+        self.buffer = bytearray()
+        self.on_text = on_text
+
+    def feed(self, data):
+        self.buffer.extend(data)
+        frames = []
+        while True:
+            start = self.buffer.find(FRAME_START)
+            if start < 0:
+                self._text(self.buffer)
+                self.buffer.clear()
+                return frames
+            self._text(self.buffer[:start])
+            del self.buffer[:start]
+            if len(self.buffer) < 3:
+                return frames
+            length = self.buffer[1]
+            if length > MAX_FRAME_PAYLOAD:
+                del self.buffer[:1]
+                continue
+            if len(self.buffer) < length + 5:
+                return frames
+            body = bytes(self.buffer[1:length + 3])
+            crc = self.buffer[length + 3] | (self.buffer[length + 4] << 8)
+            if crc16(body) != crc:
+                del self.buffer[:1]
+                continue
+            frames.append((body[1], body[2:]))
+            del self.buffer[:length + 5]
+
+    def _text(self, data):
+        if data and self.on_text:
+            self.on_text(bytes(data).decode("ascii", "replace"))
+
+
+class Device:
+    def __init__(self, port, baud, timeout, show_log):
+        import serial  # imported lazily so --help works without pyserial
+        self.port = serial.Serial(port, baud, timeout=0.05)
+        self.timeout = timeout
+        self.reader = FrameReader(sys.stderr.write if show_log else None)
+
+    def command(self, frame_type, payload=b""):
+        self.port.write(encode_frame(frame_type, payload))
+        deadline = time.time() + self.timeout
+        while time.time() < deadline:
+            for response_type, response in self.reader.feed(self.port.read(64)):
+                if response_type == frame_type | RESPONSE_FLAG:
+                    if response[0] == BUSY:
+                        # the sketch is still writing the previous command's data to EEPROM
+                        self.port.write(encode_frame(frame_type, payload))
+                        continue
+                    if response[0] != 0:
+                        status = STATUS[response[0]] if response[0] < len(STATUS) else response[0]
+                        raise SystemExit("command failed: %s" % status)
+                    return response[1:]
+        raise SystemExit("no response from device")
+
+
+# ----------------------------------------------------------------------------
+# Commands
+# ----------------------------------------------------------------------------
+
+def cmd_ping(device, args):
+    version, num_stats, num_modes = device.command(PING)[:3]
+    print("protocol v%d, %d stats, %d modes" % (version, num_stats, num_modes))
+
+
+def cmd_get_config(device, args):
+    os_modes = read_enum("keymap.h", "OSMode")
+    layouts = read_enum("keymap.h", "KeyboardLayout")
+    modes = read_enum("keymap.h", "Mode")
+    response = device.command(GET_CONFIG)
+    os_mode, layout, entry, current, trace = response[:5]
+    print("os mode:     %s" % os_modes[os_mode])
+    print("layout:      %s" % layouts[layout])
+    print("entry point: %s" % modes[entry])
+    print("mode:        %s" % modes[current])
+    print("trace:       %s" % ("on" if trace else "off"))
+    if len(response) > 5:
+        print("profile:     %s" % ("none" if response[5] == UNCHANGED else response[5] + 1))
+
+
+def cmd_set_config(device, args):
+    payload = [UNCHANGED, UNCHANGED, UNCHANGED]
+    if args.os:
+        payload[0] = name_to_index(read_enum("keymap.h", "OSMode"), args.os, "os mode")
+    if args.layout:
+        payload[1] = name_to_index(read_enum("keymap.h", "KeyboardLayout"), args.layout, "layout")
+    if args.entry:
+        payload[2] = name_to_index(read_enum("keymap.h", "Mode"), args.entry, "mode")
+    device.command(SET_CONFIG, bytes(payload))
+
+
+def cmd_profile(device, args):
+    # numbered like the F-keys that select them
+    device.command(ACTIVATE_PROFILE, bytes([args.number - 1]))
+
+
+def cmd_upload_keymap(device, args):
+    specs = read_layout(args.layout_header)
+    per_frame = (MAX_FRAME_PAYLOAD - 2) // 4
+    for first in range(0, len(specs), per_frame):
+        chunk = specs[first:first + per_frame]
+        payload = bytes([first, len(chunk)] + [field for spec in chunk for field in spec])
+        device.command(UPLOAD_KEYMAP, payload)
+    print("uploaded %d keys; select it with: set-config --layout custom" % len(specs))
+
+
+def cmd_upload_programs(device, args):
+    image = assemble_programs(args.source) if args.source else bytes([VM_END_OF_IMAGE])
+    per_frame = MAX_FRAME_PAYLOAD - 1
+    for offset in range(0, len(image), per_frame):
+        device.command(UPLOAD_PROGRAMS, bytes([offset]) + image[offset:offset + per_frame])
+    device.command(COMMIT_PROGRAMS)
+    print("uploaded %d byte program image" % len(image))
+
+
+def parse_report(text):
+    report = [int(byte, 16) for byte in text.split()]
+    if len(report) != 8:
+        raise SystemExit("a report is 8 hex bytes, e.g. '04 00 14 00 00 00 00 00'")
+    return report
+
+
+def cmd_benchmark(device, args):
+    mode = name_to_index(read_enum("keymap.h", "Mode"), args.mode, "mode")
+    per_command = eval_define("MaxBenchmarkIterations", read_defines("keymap_vm.h"))
+    native = program = 0
+    for first in range(0, args.iterations, per_command):
+        count = min(per_command, args.iterations - first)
+        payload = bytes([mode, count & 0xFF, count >> 8] + parse_report(args.report))
+        chunk_native, chunk_program, instructions = struct.unpack("<IIH", device.command(BENCHMARK, payload)[:10])
+        native += chunk_native
+        program += chunk_program
+    print("native:  %8.1f us/report" % (native / args.iterations))
+    print("program: %8.1f us/report, %d instructions/report" % (program / args.iterations, instructions))
+
+
+def cmd_tuning(device, args):
+    names = read_enum("tuning.h", "TuningId")[:-1]  # drop NumTunings
+    if args.value is not None:
+        tuning = name_to_index(names, args.name, "tuning")
+        device.command(SET_TUNING, struct.pack("<BH", tuning, args.value))
+    for tuning, name in enumerate(names):
+        if args.name and tuning != name_to_index(names, args.name, "tuning"):
+            continue
+        value, = struct.unpack("<H", device.command(GET_TUNING, bytes([tuning]))[:2])
+        print("%-28s %d" % (name, value))
+
+
+def cmd_stats(device, args):
+    names = read_enum("stats.h", "StatId")[:-1]  # drop NumStats
+    values = {}
+    first = 0
+    while True:
+        response = device.command(GET_STATS, bytes([first, 255]))
+        total, start, count = response[:3]
+        for i in range(count):
+            value, = struct.unpack_from("<I", response, 3 + 4 * i)
+            name = names[start + i] if start + i < len(names) else "stat%d" % (start + i)
+            print("%-28s %d" % (name, value))
+            values[name] = value
+        first = start + count
+        if count == 0 or first >= total:
+            break
+    if "FrameAlignedReportsStat" in values and values["FrameAlignedReportsStat"]:
+        print("%-28s %.1f" % ("(mean frame offset us)",
+                              values["FrameOffsetTotalMicrosStat"] / values["FrameAlignedReportsStat"]))
+    lookups = values.get("TransformCacheHitsStat", 0) + values.get("TransformCacheMissesStat", 0)
+    if lookups:
+        print("%-28s %.1f%%" % ("(transform cache hit rate)", 100.0 * values["TransformCacheHitsStat"] / lookups))
+    if values.get("InputReportsStat"):
+        print("%-28s %.2f" % ("(reports out per report in)",
+                              values["OutputReportsStat"] / values["InputReportsStat"]))
+    if values.get("ShiftConflictsStat"):
+        print("%-28s %.2f" % ("(reports per shift conflict)",
+                              values["ShiftConflictReportsStat"] / values["ShiftConflictsStat"]))
+    if values.get("PassthroughReportsStat"):
+        print("%-28s %.1f" % ("(mean passthrough us)",
+                              values["PassthroughTotalMicrosStat"] / values["PassthroughReportsStat"]))
+    if values.get("TypingMicrosStat"):
+        print("%-28s %.1f" % ("(typed characters per s)",
+                              values["TypedCharactersStat"] * 1e6 / values["TypingMicrosStat"]))
+        print("%-28s %.1f" % ("(reports per character)",
+                              values["TypingReportsStat"] / values["TypedCharactersStat"]))
+    decided = values.get("HomeRowTapsStat", 0) + values.get("HomeRowHoldsStat", 0)
+    if decided:
+        print("%-28s %.1f" % ("(mean home-row wait ms)", values["HomeRowDecisionTotalMillisStat"] / decided))
+        misfires = values["HomeRowUnusedHoldsStat"] + values["HomeRowCorrectionsStat"]
+        print("%-28s %.1f%%" % ("(home-row misfire rate)",
+                                100.0 * misfires / (decided + values["HomeRowBurstTapsStat"])))
+    if values.get("UsbRecoveriesStat"):
+        print("%-28s %.1f" % ("(mean usb recovery ms)",
+                              values["UsbRecoveryTotalMillisStat"] / values["UsbRecoveriesStat"]))
+    print_task_stats(device)
+
+
+def print_task_stats(device):
+    names = read_enum("scheduler.h", "TaskId")[:-1]  # drop NumTasks
+    print()
+    print("%-28s %10s %8s %8s %8s" % ("task", "runs", "mean us", "max us", "late"))
+    task = 0
+    while True:
+        response = device.command(GET_TASK_STATS, bytes([task]))
+        total = response[0]
+        if not total:
+            print("(not kept: build the sketch with TASK_STATS)")
+            break
+        runs, total_micros, max_micros, late = struct.unpack_from("<4I", response, 1)
+        name = names[task] if task < len(names) else "task%d" % task
+        print("%-28s %10d %8.1f %8d %8d" % (name, runs, total_micros / runs if runs else 0, max_micros, late))
+        task += 1
+        if task >= total:
+            break
+
+
+def cmd_boot_timeline(device, args):
+    names = read_enum("boot_timeline.h", "BootStage")[:-1]  # drop NumBootStages
+    print("%-28s %10s %10s" % ("stage", "ms", "+ms"))
+    stage = 0
+    previous = 0
+    while True:
+        response = device.command(GET_BOOT_STAGE, bytes([stage]))
+        total = response[0]
+        micros, = struct.unpack_from("<I", response, 1)
+        name = names[stage] if stage < len(names) else "stage%d" % stage
+        if micros:
+            print("%-28s %10.1f %10.1f" % (name, micros / 1000.0, (micros - previous) / 1000.0))
+            previous = max(previous, micros)
+        else:
+            print("%-28s %10s" % (name, "-"))
+        stage += 1
+        if stage >= total:
+            break
+
+
+def get_usage(device, kind):
+    values = []
+    while True:
+        response = device.command(GET_USAGE, bytes([kind, len(values), 255]))
+        _, total, _, count = response[:4]
+        values += struct.unpack_from("<%dI" % count, response, 4)
+        if count == 0 or len(values) >= total:
+            return values
+
+
+def cmd_usage(device, args):
+    if args.flush:
+        device.command(FLUSH_USAGE)
+        return
+    defines = read_defines("keys.h")
+    first_key = eval_define("FirstUsageKey", dict(defines, **read_defines("usage.h")))
+    key_names = {}
+    for name in defines:
+        if re.match(r"_\w+$", name):
+            key_names.setdefault(eval_define(name, defines), name)
+    modes = read_enum("keymap.h", "Mode")
+    events = read_enum("usage.h", "UsageEvent")[:-1]  # drop NumUsageEvents
+    kinds = read_enum("usage.h", "UsageKind")
+
+    keys = get_usage(device, kinds.index("KeyPressesUsage"))
+    total = sum(keys) or 1
+    print("key presses (relative):")
+    for index, count in sorted(enumerate(keys), key=lambda item: -item[1])[:args.top]:
+        if count:
+            name = key_names.get(first_key + index, "key%d" % (first_key + index))
+            print("  %-24s %8d %5.1f%%" % (name, count, 100.0 * count / total))
+    print("mode residency:")
+    for index, seconds in enumerate(get_usage(device, kinds.index("ModeSecondsUsage"))):
+        if seconds:
+            print("  %-24s %8d:%02d:%02d" % (modes[index], seconds // 3600, seconds // 60 % 60, seconds % 60))
+    print("events:")
+    for index, count in enumerate(get_usage(device, kinds.index("EventsUsage"))):
+        print("  %-24s %8d" % (events[index], count))
+
+
+def cmd_reset_stats(device, args):
+    device.command(RESET_STATS)
+
+
+def cmd_trace(device, args):
+    device.command(SET_TRACE, bytes([args.state == "on"]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--port", default="/dev/ttyACM0", help="serial port of the Arduino")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--timeout", type=float, default=2.0, help="seconds to wait for a response")
+    parser.add_argument("--show-log", action="store_true", help="echo the device log to stderr")
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    commands.add_parser("ping").set_defaults(run=cmd_ping)
+    commands.add_parser("get-config").set_defaults(run=cmd_get_config)
+    sub = commands.add_parser("set-config")
+    sub.add_argument("--os", help="Windows or OSX")
+    sub.add_argument("--layout", help="qwerty, dvorak or custom")
+    sub.add_argument("--entry", help="entry point mode, e.g. ModalNoKeys")
+    sub.set_defaults(run=cmd_set_config)
+    sub = commands.add_parser("profile", help="switch to a profile (see modal_keys/profiles.cpp)")
+    sub.add_argument("number", type=int, help="1 for the profile on Escape+F1 and RightCtrl+1, ...")
+    sub.set_defaults(run=cmd_profile)
+    sub = commands.add_parser("upload-keymap", help="upload a layout_*.h file as the custom layout")
+    sub.add_argument("layout_header")
+    sub.set_defaults(run=cmd_upload_keymap)
+    sub = commands.add_parser("upload-programs", help="assemble and upload keymap programs")
+    sub.add_argument("source", nargs="?", help="program source; omit to remove all programs")
+    sub.set_defaults(run=cmd_upload_programs)
+    sub = commands.add_parser("benchmark", help="time a report with the compiled keymap and the uploaded program")
+    sub.add_argument("mode")
+    sub.add_argument("report", help="8 hex bytes; must not change the OS mode")
+    sub.add_argument("--iterations", type=int, default=1000)
+    sub.set_defaults(run=cmd_benchmark)
+    sub = commands.add_parser("tuning", help="show or set timing parameters")
+    sub.add_argument("name", nargs="?", help="e.g. ComboWindowTuning or ComboWindow")
+    sub.add_argument("value", nargs="?", type=int)
+    sub.set_defaults(run=cmd_tuning)
+    commands.add_parser("stats").set_defaults(run=cmd_stats)
+    commands.add_parser("reset-stats").set_defaults(run=cmd_reset_stats)
+    sub = commands.add_parser("usage", help="show the key, mode and event usage counters")
+    sub.add_argument("--top", type=int, default=20, help="number of keys to show")
+    sub.add_argument("--flush", action="store_true", help="write the counters to EEPROM now")
+    sub.set_defaults(run=cmd_usage)
+    commands.add_parser("boot-timeline", help="show how long startup took, up to the first keystroke").set_defaults(
+        run=cmd_boot_timeline)
+    sub = commands.add_parser("trace", help="turn the serial log on or off")
+    sub.add_argument("state", choices=["on", "off"])
+    sub.set_defaults(run=cmd_trace)
+
+    args = parser.parse_args()
+    device = Device(args.port, args.baud, args.timeout, args.show_log)
+    args.run(device, args)
+
+
+if __name__ == "__main__":
+    main()